@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "die.h"
+#include "accum.h"
+#include "kernels.h"
+
+static void mapframes(accum *a, size_t frames) {
+    size_t bytes = sizeof(float) * frames * a->channels;
+
+    // a sparse file reads back as zeroes, which is exactly the starting state we want
+    if ( ftruncate(a->fd, bytes) )
+        die("Couldn't size scratch file");
+
+    if ( (a->data = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, a->fd, 0)) == MAP_FAILED )
+        die("Couldn't map scratch file");
+
+    posix_madvise(a->data, bytes, POSIX_MADV_SEQUENTIAL);
+
+    a->frames = frames;
+}
+
+accum * accum_new(char *path, size_t frames, int channels) {
+    accum *a;
+
+    if ( (a = malloc(sizeof(*a))) == NULL )
+        die("Couldn't malloc space for accumulator");
+
+    if ( (a->fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0 )
+        diem("Couldn't create scratch file", path);
+    if ( unlink(path) )
+        diem("Couldn't unlink scratch file", path);
+
+    a->channels = channels;
+    mapframes(a, frames > 0 ? frames : 1);
+
+    return a;
+}
+
+void accum_add(accum *a, size_t at, float *data, size_t frames, float scale) {
+    if ( at + frames > a->frames ) {
+        size_t grow = a->frames;
+        while ( grow < at + frames )
+            grow *= 2;
+
+        munmap(a->data, sizeof(float) * a->frames * a->channels);
+        mapframes(a, grow);
+    }
+
+    kernels.addscaled(&a->data[at * a->channels], data, scale, frames * a->channels);
+}
+
+void accum_free(accum *a) {
+    munmap(a->data, sizeof(float) * a->frames * a->channels);
+    close(a->fd);
+    free(a);
+}
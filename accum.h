@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef __ACCUM_H__
+#define __ACCUM_H__
+
+#include <stddef.h>
+
+// a float32 accumulator for interleaved frames, backed by a memory-mapped
+// scratch file rather than memory. the file is unlinked as soon as it is
+// mapped, so nothing is left behind however the process ends.
+typedef struct {
+    int fd;
+    int channels;
+    size_t frames;  // frames mapped, always zero until written
+    float *data;
+} accum;
+
+accum * accum_new(char *path, size_t frames, int channels);
+
+// add frames frames of data times scale into the accumulator starting at
+// frame at, growing it if needed
+void accum_add(accum *a, size_t at, float *data, size_t frames, float scale);
+
+void accum_free(accum *a);
+
+#endif
@@ -0,0 +1,516 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "die.h"
+#include "engine.h"
+#include "fft.h"
+#include "kernels.h"
+#include "partconv.h"
+
+// convolute-bench runs the engine over a matrix of synthetic impulse and
+// input lengths and reports one line per case, as csv or json:
+//
+//   samples_per_s    input frames convolved per second of processing
+//   realtime_factor  seconds of 48kHz input per second of processing
+//   peak_rss_kb      the case's peak resident memory, each runs in its own process
+//   passes           how many times the input was convolved, repeated up to
+//                    the minimum time so short cases still time reliably
+//   snr_db, max_err  against a double precision direct convolution at
+//                    BENCH_CHECKS output frames
+//   snr_f32_db       with -P f16 or bf16, against the same engine storing
+//                    its spectra as float32, at the same frames
+//
+// the float32 path sits some 130dB under the signal, so at 16 bits both
+// snrs are the rounding of the spectra. over the quick matrix that comes
+// to about 74dB for float16 and 56dB for bfloat16, and the default -s
+// drops to 60 and 40 to go with them. impulses short enough to convolve
+// directly have no spectra and come out as they would at float32.
+//
+// nothing is read from or written to disk, the signals are generated from
+// their sample index so any of them can be recomputed for the reference.
+
+#define BENCH_RATE 48000
+#define BENCH_CHECKS 64
+
+static const int quicktaps[] = { 1000, 10000, 100000 };
+static const int quickseconds[] = { 1, 10, 60 };
+static const int fulltaps[] = { 1000, 10000, 100000, 1000000, 10000000 };
+static const int fullseconds[] = { 1, 10, 60, 600, 3600 };
+
+typedef struct {
+    int taps;
+    int seconds;
+    int blocksize;
+    int passes;
+    double preparetime;
+    double processtime;
+    long peakrss;
+    double snr;
+    double maxerr;
+    double f32snr;
+    int failed; // an engine error code
+} benchresult;
+
+typedef struct {
+    int threads;
+    int latency;
+    double mintime;
+    double minsnr;
+    int precision; // of the spectra, one of the PC_ formats
+} benchopts;
+
+static const char *precisionnames[] = { "f32", "f16", "bf16" };
+
+// a comma separated list of positive numbers into at most max of them
+static int parselist(char *arg, int *list, int max) {
+    int n = 0;
+
+    for (char *tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+        if ( n == max || (list[n++] = atoi(tok)) < 1 )
+            die("Lists take up to 16 positive numbers");
+    }
+
+    return n;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// white noise in [-1,1) as a pure function of the sample index
+static float noise(uint64_t n) {
+    n += 0x9e3779b97f4a7c15ULL;
+    n = (n ^ (n >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    n = (n ^ (n >> 27)) * 0x94d049bb133111ebULL;
+    n ^= n >> 31;
+    return (int32_t) (n >> 32) / 2147483648.0f;
+}
+
+static float inputsample(uint64_t n) {
+    return 0.5f * noise(n ^ 0x5555555555555555ULL);
+}
+
+// noise decaying by 60dB over its length, scaled to unit energy so the
+// output has about the input's level
+static float * makeimpulse(int taps) {
+    float *ir;
+    double energy = 0;
+
+    if ( (ir = malloc(sizeof(float) * taps)) == NULL )
+        return NULL;
+
+    for (int k = 0; k < taps; k++) {
+        ir[k] = noise(k) * exp(-6.9 * k / taps);
+        energy += (double) ir[k] * ir[k];
+    }
+
+    float scale = 1 / sqrt(energy);
+    for (int k = 0; k < taps; k++)
+        ir[k] *= scale;
+
+    return ir;
+}
+
+static double reference(const float *ir, int taps, uint64_t inlen, uint64_t n) {
+    double sum = 0;
+    uint64_t first = n >= inlen ? n - inlen + 1 : 0;
+
+    for (uint64_t k = first; k < (uint64_t) taps && k <= n; k++)
+        sum += (double) ir[k] * inputsample(n - k);
+
+    return sum;
+}
+
+static int compareu64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+// the output frames checked against the reference: the very start, where
+// the impulse runs out, the very end and some in between
+static void pickchecks(uint64_t *at, uint64_t outlen, int taps) {
+    uint64_t seed = 1;
+    int n = 0;
+
+    at[n++] = 0;
+    at[n++] = taps - 1 < outlen ? taps - 1 : outlen - 1;
+    at[n++] = outlen - 1;
+    while ( n < BENCH_CHECKS ) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        at[n++] = (seed >> 11) % outlen;
+    }
+
+    qsort(at, BENCH_CHECKS, sizeof(uint64_t), compareu64);
+}
+
+// one pass of the whole input through e, keeping the output at the check
+// frames. returns the seconds spent in engine_process.
+static double runpass(engine *e, float *in, float *out, int batchblocks, uint64_t inlen, uint64_t outlen,
+                      const uint64_t *checkat, double *got) {
+    int frames = batchblocks * engine_blocksize(e);
+    uint64_t at = 0;
+    int check = 0;
+    double took = 0;
+
+    engine_reset(e);
+
+    while ( at < outlen ) {
+        // generating the input isn't part of the time
+        for (int i = 0; i < frames; i++)
+            in[i] = at + i < inlen ? inputsample(at + i) : 0;
+
+        double start = now();
+        engine_process(e, in, out, batchblocks);
+        took += now() - start;
+
+        while ( check < BENCH_CHECKS && checkat[check] < at + frames ) {
+            got[check] = out[checkat[check] - at];
+            check++;
+        }
+        at += frames;
+    }
+
+    return took;
+}
+
+static double snrof(const double *want, const double *got, double *maxerr) {
+    double signal = 0, noise = 0;
+
+    *maxerr = 0;
+    for (int i = 0; i < BENCH_CHECKS; i++) {
+        double diff = fabs(got[i] - want[i]);
+        signal += want[i] * want[i];
+        noise += diff * diff;
+        if ( diff > *maxerr )
+            *maxerr = diff;
+    }
+
+    return noise > 0 ? 10 * log10(signal / noise) : INFINITY;
+}
+
+static long peakrss(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+// the same input through a float32 engine, for what reduced precision
+// spectra cost against it
+static int comparef32(benchresult *r, benchopts *o, const float *ir, uint64_t inlen, uint64_t outlen,
+                      const uint64_t *checkat, const double *got) {
+    engineopts eo = { o->latency, o->threads };
+    float *in = NULL, *out = NULL;
+    double want[BENCH_CHECKS], maxerr;
+    engine *e = NULL;
+    int err;
+
+    if ( (err = engine_new(&e, &eo)) || (err = engine_prepare(e, ir, r->taps, 1, BENCH_RATE)) || (err = engine_start(e, 1)) )
+        goto done;
+
+    in = malloc(sizeof(float) * engine_blocksize(e) * o->threads);
+    out = malloc(sizeof(float) * engine_blocksize(e) * o->threads * engine_outchannels(e));
+    if ( in == NULL || out == NULL ) {
+        err = ENGINE_ENOMEM;
+        goto done;
+    }
+
+    runpass(e, in, out, o->threads, inlen, outlen, checkat, want);
+    r->f32snr = snrof(want, got, &maxerr);
+
+done:
+    engine_free(e);
+    free(in);
+    free(out);
+    return err;
+}
+
+static void runcase(benchresult *r, benchopts *o) {
+    engineopts eo = { o->latency, o->threads };
+    float *ir, *in = NULL, *out = NULL;
+    engine *e = NULL;
+    int err;
+
+    eo.precision = o->precision;
+
+    if ( (ir = makeimpulse(r->taps)) == NULL ) {
+        r->failed = ENGINE_ENOMEM;
+        return;
+    }
+
+    double start = now();
+    if ( (err = engine_new(&e, &eo)) || (err = engine_prepare(e, ir, r->taps, 1, BENCH_RATE)) || (err = engine_start(e, 1)) ) {
+        r->failed = err;
+        engine_free(e);
+        free(ir);
+        return;
+    }
+    r->preparetime = now() - start;
+
+    int blocksize = r->blocksize = engine_blocksize(e);
+    int batchblocks = o->threads;
+    uint64_t inlen = (uint64_t) r->seconds * BENCH_RATE;
+    uint64_t outlen = inlen + r->taps - 1;
+    uint64_t checkat[BENCH_CHECKS];
+    double got[BENCH_CHECKS], want[BENCH_CHECKS];
+
+    pickchecks(checkat, outlen, r->taps);
+
+    in = malloc(sizeof(float) * blocksize * batchblocks);
+    out = malloc(sizeof(float) * blocksize * batchblocks * engine_outchannels(e));
+    if ( in == NULL || out == NULL ) {
+        r->failed = ENGINE_ENOMEM;
+        goto done;
+    }
+
+    r->processtime = 0;
+    r->passes = 0;
+    do {
+        r->processtime += runpass(e, in, out, batchblocks, inlen, outlen, checkat, got);
+        r->passes++;
+    } while ( r->processtime < o->mintime );
+
+    for (int i = 0; i < BENCH_CHECKS; i++)
+        want[i] = reference(ir, r->taps, inlen, checkat[i]);
+    r->snr = snrof(want, got, &r->maxerr);
+
+    // the case's own peak, before any float32 engine to compare with
+    r->peakrss = peakrss();
+
+    engine_free(e);
+    e = NULL;
+    if ( o->precision != PC_FLOAT32 )
+        r->failed = comparef32(r, o, ir, inlen, outlen, checkat, got);
+
+done:
+    fft_finish();
+    engine_free(e);
+    free(ir);
+    free(in);
+    free(out);
+}
+
+// each case runs in a child, so its peak memory is its own
+static void forkcase(benchresult *r, benchopts *o) {
+    int fds[2];
+    pid_t pid;
+
+    if ( pipe(fds) )
+        die("Couldn't make a pipe");
+
+    if ( (pid = fork()) < 0 )
+        die("Couldn't fork");
+
+    if ( pid == 0 ) {
+        close(fds[0]);
+        runcase(r, o);
+        if ( write(fds[1], r, sizeof(*r)) != sizeof(*r) )
+            _exit(EXIT_FAILURE);
+        _exit(0);
+    }
+
+    close(fds[1]);
+    if ( read(fds[0], r, sizeof(*r)) != sizeof(*r) )
+        r->failed = ENGINE_ENOMEM;
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+}
+
+static void printcsvheader(FILE *f) {
+    fprintf(f, "backend,kernels,threads,latency,precision,taps,seconds,blocksize,passes,prepare_s,process_s,"
+               "samples_per_s,realtime_factor,peak_rss_kb,snr_db,max_err,snr_f32_db,ok\n");
+}
+
+static int accurate(benchresult *r, benchopts *o) {
+    return !r->failed && r->snr >= o->minsnr;
+}
+
+static void printcsv(FILE *f, benchresult *r, benchopts *o) {
+    double frames = (double) r->seconds * BENCH_RATE * r->passes;
+
+    if ( r->failed ) {
+        fprintf(f, "%s,%s,%d,%d,%s,%d,%d,,,,,,,,,,,%s\n", fft_backend(), kernels_name(), o->threads, o->latency,
+                precisionnames[o->precision], r->taps, r->seconds, engine_strerror(r->failed));
+        return;
+    }
+
+    fprintf(f, "%s,%s,%d,%d,%s,%d,%d,%d,%d,%.6f,%.6f,%.0f,%.2f,%ld,%.1f,%.3g,",
+            fft_backend(), kernels_name(), o->threads, o->latency, precisionnames[o->precision], r->taps, r->seconds,
+            r->blocksize, r->passes, r->preparetime, r->processtime, frames / r->processtime,
+            frames / BENCH_RATE / r->processtime, r->peakrss, r->snr, r->maxerr);
+    if ( o->precision != PC_FLOAT32 )
+        fprintf(f, "%.1f", r->f32snr);
+    fprintf(f, ",%d\n", accurate(r, o));
+}
+
+static void printjson(FILE *f, benchresult *r, benchopts *o, int first) {
+    double frames = (double) r->seconds * BENCH_RATE * r->passes;
+
+    fprintf(f, "%s    {\"taps\": %d, \"seconds\": %d", first ? "" : ",\n", r->taps, r->seconds);
+    if ( r->failed ) {
+        fprintf(f, ", \"error\": \"%s\"}", engine_strerror(r->failed));
+        return;
+    }
+
+    fprintf(f, ", \"blocksize\": %d, \"passes\": %d, \"prepare_s\": %.6f, \"process_s\": %.6f"
+               ", \"samples_per_s\": %.0f, \"realtime_factor\": %.2f, \"peak_rss_kb\": %ld"
+               ", \"snr_db\": %.1f, \"max_err\": %.3g",
+            r->blocksize, r->passes, r->preparetime, r->processtime, frames / r->processtime,
+            frames / BENCH_RATE / r->processtime, r->peakrss, isinf(r->snr) ? 999.0 : r->snr, r->maxerr);
+    if ( o->precision != PC_FLOAT32 )
+        fprintf(f, ", \"snr_f32_db\": %.1f", isinf(r->f32snr) ? 999.0 : r->f32snr);
+    fprintf(f, ", \"ok\": %s}", accurate(r, o) ? "true" : "false");
+}
+
+#define USAGE "Usage: convolute-bench [-f] [-J] [-t taps,...] [-d seconds,...] [-j threads] [-l latency] [-m seconds] [-p estimate|measure|patient] [-P f32|f16|bf16] [-s dB] [-o output]\n" \
+              "  -f  the full matrix, 1k to 10M taps against 1s to 1h of input\n" \
+              "  -t  impulse lengths, -d input lengths in place of the matrix's\n" \
+              "  -J  json instead of csv\n" \
+              "  -m  time each case for at least this long, 0.5 by default\n" \
+              "  -P  how the impulse spectra are stored, f32 by default\n" \
+              "  -s  the smallest acceptable snr against the reference, by default 80, or 60 for f16 and 40 for bf16"
+
+int main(int argc, char **argv) {
+    benchopts o = { 1, 0, 0.5, 0, PC_FLOAT32 };
+    int full = 0, json = 0, planning = FFT_MEASURE;
+    int listtaps[16], listseconds[16], nlisttaps = 0, nlistseconds = 0;
+    FILE *f = stdout;
+    int c;
+
+    while ( (c = getopt(argc, argv, "d:fJj:l:m:o:p:P:s:t:")) != -1 ) {
+        switch ( c ) {
+            case 'd':
+                nlistseconds = parselist(optarg, listseconds, 16);
+                break;
+            case 'f':
+                full = 1;
+                break;
+            case 'J':
+                json = 1;
+                break;
+            case 'j':
+                if ( (o.threads = atoi(optarg)) < 1 )
+                    die("Thread count must be at least 1");
+                break;
+            case 'l':
+                o.latency = atoi(optarg);
+                if ( o.latency < 16 || (o.latency & (o.latency-1)) )
+                    die("Latency must be a power of two of at least 16");
+                break;
+            case 'm':
+                o.mintime = atof(optarg);
+                break;
+            case 'o':
+                if ( (f = fopen(optarg, "w")) == NULL )
+                    diem("Couldn't open output", optarg);
+                break;
+            case 'p':
+                if ( strcmp(optarg, "estimate") == 0 )
+                    planning = FFT_ESTIMATE;
+                else if ( strcmp(optarg, "measure") == 0 )
+                    planning = FFT_MEASURE;
+                else if ( strcmp(optarg, "patient") == 0 )
+                    planning = FFT_PATIENT;
+                else
+                    die("Planning must be one of estimate, measure or patient");
+                break;
+            case 'P':
+                for (o.precision = PC_BFLOAT16; o.precision >= 0; o.precision--)
+                    if ( strcmp(optarg, precisionnames[o.precision]) == 0 )
+                        break;
+                if ( o.precision < 0 )
+                    die("Precision must be one of f32, f16 or bf16");
+                break;
+            case 's':
+                o.minsnr = atof(optarg);
+                break;
+            case 't':
+                nlisttaps = parselist(optarg, listtaps, 16);
+                break;
+            default:
+                die(USAGE);
+        }
+    }
+
+    const int *taps = full ? fulltaps : quicktaps;
+    const int *seconds = full ? fullseconds : quickseconds;
+    int ntaps = full ? sizeof(fulltaps)/sizeof(int) : sizeof(quicktaps)/sizeof(int);
+    int nseconds = full ? sizeof(fullseconds)/sizeof(int) : sizeof(quickseconds)/sizeof(int);
+    if ( nlisttaps ) {
+        taps = listtaps;
+        ntaps = nlisttaps;
+    }
+    if ( nlistseconds ) {
+        seconds = listseconds;
+        nseconds = nlistseconds;
+    }
+    int bad = 0;
+
+    if ( o.minsnr == 0 )
+        o.minsnr = o.precision == PC_FLOAT16 ? 60 : o.precision == PC_BFLOAT16 ? 40 : 80;
+
+    fft_init(planning);
+
+    if ( json )
+        fprintf(f, "{\"backend\": \"%s\", \"kernels\": \"%s\", \"threads\": %d, \"latency\": %d, \"precision\": \"%s\""
+                   ", \"results\": [\n", fft_backend(), kernels_name(), o.threads, o.latency, precisionnames[o.precision]);
+    else
+        printcsvheader(f);
+
+    for (int t = 0; t < ntaps; t++) {
+        for (int s = 0; s < nseconds; s++) {
+            benchresult r;
+
+            memset(&r, 0, sizeof(r));
+            r.taps = taps[t];
+            r.seconds = seconds[s];
+
+            forkcase(&r, &o);
+            bad += !accurate(&r, &o);
+
+            if ( json )
+                printjson(f, &r, &o, t == 0 && s == 0);
+            else
+                printcsv(f, &r, &o);
+            fflush(f);
+
+            if ( f != stdout )
+                fprintf(stderr, "%d taps, %d s: %s\n", r.taps, r.seconds, r.failed ? engine_strerror(r.failed) :
+                        accurate(&r, &o) ? "ok" : "inaccurate");
+        }
+    }
+
+    if ( json )
+        fprintf(f, "\n]}\n");
+    if ( f != stdout )
+        fclose(f);
+
+    return bad ? EXIT_FAILURE : 0;
+}
@@ -14,366 +14,617 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdbool.h>
-
-#ifdef USE_FFTW3
-//#include <complex.h>
-#include <fftw3.h>
-#else
-#include "kissfft/kiss_fftr.h"
-#endif
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include <sndfile.h>
 
 #include "die.h"
+#include "accum.h"
 #include "convolute.h"
+#include "kernels.h"
+#include "engine.h"
+#include "pool.h"
 #include "readsoundfile.h"
-
-// this number directly corresponds to the memory usage and inversely corresponds to running time and number of passes
-#define IMPULSE_CHUNK_MAXLEN 1638400
+#include "soundin.h"
+#include "spectrafile.h"
+#include "stats.h"
 
 #define TEMPORARY_SUFFIX ".convolute-temp"
+#define SCRATCH_SUFFIX ".scratch"
+
+// frames per write when encoding the scratch accumulator
+#define ENCODE_CHUNK 65536
 
-static void addconvolute(char *inputpath, char *irpath, char *addpath, char *outputpath, float amp, int extradelay) {
-    // open the input path for reading
-    SF_INFO snd_in_info;
-    SNDFILE *snd_in;
+// one batch of blocks on its way from the reader through the engine to the writer
+typedef struct {
+    float *in;
+    float *out;
+    int blocks; // 0 marks the end of the input
+} batch;
+
+typedef struct {
+    soundin *in;
+    SNDFILE *s_out;
+    int inchannels;
+    int outchannels;
+    int insamplebytes; // as stored in the input file, for --stats
+    int blocksize;
+    int64_t steps;   // frame counts and everything derived from them can pass 2^31
+    int64_t outlen;
+    float amp;
+
+    int64_t readsteps;
+    int64_t writesteps;
+    int64_t totalclipped;
+    float maxval;
+
+    // when set, blocks are summed in here and only encoded at the end
+    accum *scratch;
+    int normalize;
+    float renderpeak; // largest magnitude added to scratch, when normalizing
+
+    // set when several files are convolved at once: no progress lines, and
+    // messages name the file they're about
+    char *name;
+
+    // batches cycle from empty to full (read) to done (convolved) and back.
+    // each queue has one thread pushing and one popping.
+    spscqueue empty;
+    spscqueue full;
+    spscqueue done;
+} job;
+
+// one batch being decoded, one convolved and one encoded, and one spare so
+// a slow block on either side doesn't stall the engine at once
+#define BATCH_BUFFERS 4
+
+// batches are at least this many frames, so that short blocks don't hand
+// buffers between threads for every few samples
+#define BATCH_FRAMES 16384
+
+// read the next blocks of input into b, padding with silence past the end
+static void readbatch(job *j, batch *b, int blocks) {
+    int frames = blocks * j->blocksize;
+    statclock clock;
+
+    stats_begin(&clock);
+    int got = soundin_read(j->in, b->in, frames);
+    stats_end(&clock, STAT_DECODE);
+    stats_bytes((uint64_t) got * j->inchannels * j->insamplebytes, 0);
+
+    for (int i = got*j->inchannels; i < frames*j->inchannels; i++)
+        b->in[i] = 0;
+
+    b->blocks = blocks;
+    j->readsteps += blocks;
+}
+
+// write out the part we're done with, or add it into the scratch accumulator
+static void writebatch(job *j, batch *b) {
+    int samples = b->blocks * j->blocksize * j->outchannels;
+
+    // the last step is smaller than the rest
+    int64_t towrite = j->outlen - j->writesteps*j->blocksize;
+    if ( towrite > b->blocks * j->blocksize )
+        towrite = b->blocks * j->blocksize;
+
+    statclock clock;
+    if ( j->scratch ) {
+        stats_begin(&clock);
+        accum_add(j->scratch, j->writesteps*j->blocksize, b->out, towrite, j->amp);
+        stats_end(&clock, STAT_ENCODE);
+
+        // the block is spent, so the fused scan is free to clip it
+        stats_begin(&clock);
+        if ( j->normalize )
+            kernels.clippeak(b->out, samples, j->amp, &j->renderpeak);
+        stats_end(&clock, STAT_CLIP);
+    } else {
+        // get some clipping statistics
+        stats_begin(&clock);
+        j->totalclipped += kernels.clippeak(b->out, samples, j->amp, &j->maxval);
+        stats_end(&clock, STAT_CLIP);
+
+        stats_begin(&clock);
+        sf_writef_float(j->s_out, b->out, towrite);
+        stats_end(&clock, STAT_ENCODE);
+        stats_bytes(0, (uint64_t) towrite * j->outchannels * 3);
+    }
 
-    memset(&snd_in_info, 0, sizeof(snd_in_info));
+    int64_t progressevery = j->steps/1000 + 1;
+    for (int i = 0; i < b->blocks; i++) {
+        j->writesteps++;
+        if ( j->name == NULL && ((j->writesteps-1) % progressevery == 0 || j->writesteps == j->steps) )
+            fprintf(stderr, "convoluting... %lld/%lld\033[K\r", (long long) j->writesteps, (long long) j->steps);
+    }
+}
 
-    if ( (snd_in = sf_open(inputpath, SFM_READ, &snd_in_info)) == NULL )
-        die("Couldn't open a sound file for reading");
+// the single pcm encode of a scratch accumulator at the given gain, with its clipping statistics
+static void encodescratch(job *j, float gain) {
+    float *space;
 
-    if ( snd_in_info.channels != 1 )
-        die("The input sound file has more than one channel");
+    if ( (space = malloc(sizeof(float) * ENCODE_CHUNK * j->outchannels)) == NULL )
+        die("Couldn't malloc space for encoding");
 
-    int snd_in_len = snd_in_info.frames;
+    for (int64_t at = 0; at < j->outlen; at += ENCODE_CHUNK) {
+        int frames = j->outlen - at < ENCODE_CHUNK ? j->outlen - at : ENCODE_CHUNK;
 
-    // extract the chunk of the ir we need
-    soundfile *ir = readsoundfilechunk(irpath, extradelay, IMPULSE_CHUNK_MAXLEN);
+        if ( j->name == NULL )
+            fprintf(stderr, "encoding... %d%%\033[K\r", (int) (100.0 * at / j->outlen));
 
-    if ( snd_in_info.samplerate != ir->samplerate )
-        die("Sample rates of input and impulse response are different.");
+        statclock clock;
+        stats_begin(&clock);
+        memcpy(space, &j->scratch->data[(size_t) at * j->outchannels], sizeof(float) * frames * j->outchannels);
+        j->totalclipped += kernels.clippeak(space, frames * j->outchannels, gain, &j->maxval);
+        stats_end(&clock, STAT_CLIP);
 
-    int fftlen = ir->length * 1.5 + 10000;
-    {
-        // round up to a power of two
-        int pow = 1;
-        while ( fftlen > 2 ) { pow++; fftlen /= 2; }
-        fftlen = 2 << pow;
+        stats_begin(&clock);
+        sf_writef_float(j->s_out, space, frames);
+        stats_end(&clock, STAT_ENCODE);
+        stats_bytes(0, (uint64_t) frames * j->outchannels * 3);
     }
 
-    if ( fftlen < 32768 )
-        fftlen = 32768;
-
-    // make sure we're not wasting a bunch of memory on large chunk sizes
-    // if the overlap will be wasted
-    if ( fftlen > snd_in_len + ir->length + 10 ) {
-        fftlen = snd_in_len + ir->length + 10;
-        // if fftlen is odd before this, kissfft will fail completely. this is fixed implicitly below.
-
-        // here, we need to create a number whose factorization is simple (only using factors of 2,3,4,5)
-        // but bounds fftlen as tightly as possible.
-        // this gives SIGNIFICANT performance increases when using kissfft, and a small boost when using fftw.
-
-#define TRYFACTOR(n) if ( failed && current*n > fftlen ) { current *= n; failed = false; }
-        int current = 1;
-        while ( current < fftlen ) {
-            bool failed = true;
-            TRYFACTOR(2)
-            TRYFACTOR(3)
-            TRYFACTOR(5)
-            TRYFACTOR(6) // 2*3
-            TRYFACTOR(9) // 3*3
-            TRYFACTOR(10) // 2*5
-            TRYFACTOR(12) // 2*2*3
-            TRYFACTOR(15) // 3*5
-            TRYFACTOR(18) // 2*3*3
-            TRYFACTOR(20) // 2*2*5
-            TRYFACTOR(25) // 5*5
-            TRYFACTOR(30) // 2*3*5
-            TRYFACTOR(36) // 2*2*3*3
-            TRYFACTOR(45) // 3*3*5
-            TRYFACTOR(75) // 3*5*5
-            if ( failed ) {
-                // can't bound it with an optimized factor yet, add a power of 4
-                current *= 4;
-            }
-        }
-#undef TRYFACTOR
-        fftlen = current;
+    free(space);
+}
+
+static void * readerthread(void *arg) {
+    job *j = arg;
+    batch *b;
+
+    while ( j->readsteps < j->steps ) {
+        b = spsc_pop(&j->empty);
+        int blocks = j->steps - j->readsteps < b->blocks ? j->steps - j->readsteps : b->blocks;
+        readbatch(j, b, blocks);
+        spsc_push(&j->full, b);
     }
 
-    int stepsize = fftlen - ir->length - 10;
-    int steps = (snd_in_len + stepsize - 1) / stepsize;
+    b = spsc_pop(&j->empty);
+    b->blocks = 0;
+    spsc_push(&j->full, b);
 
-#ifdef SPEW
-    fprintf(stderr, "fftlen is %d\ndoing %d steps of size %d\n", fftlen, steps, stepsize);
-#endif
+    return NULL;
+}
 
-#ifdef USE_FFTW3
-    fftwf_plan p_fw, p_bw;
-    fftwf_complex *f_out, *f_ir;
-#else
-    kiss_fftr_cfg cfg_fw, cfg_bw;
-    kiss_fft_cpx *f_out, *f_ir;
-#endif
-    float *revspace, *outspace, *inspace;
-
-    // get some space for our temporary arrays
-#ifdef USE_FFTW3
-    if ( (f_out = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * (fftlen/2+1))) == NULL )
-        die("Couldn't malloc space for output fft");
-    if ( (f_ir = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * (fftlen/2+1))) == NULL )
-        die("Couldn't malloc space for output fft");
-    if ( (revspace = fftwf_malloc(sizeof(float) * fftlen)) == NULL )
-        die("Couldn't malloc space for output scalars");
-#else
-    if ( (f_out = KISS_FFT_MALLOC(sizeof(kiss_fft_cpx) * (fftlen/2+1))) == NULL )
-        die("Couldn't malloc space for output fft");
-    if ( (f_ir = KISS_FFT_MALLOC(sizeof(kiss_fft_cpx) * (fftlen/2+1))) == NULL )
-        die("Couldn't malloc space for output fft");
-    if ( (revspace = KISS_FFT_MALLOC(sizeof(float) * fftlen)) == NULL )
-        die("Couldn't malloc space for output scalars");
-#endif
+static void * writerthread(void *arg) {
+    job *j = arg;
+    batch *b;
 
-    if ( (outspace = malloc(sizeof(float) * fftlen)) == NULL )
-        die("Couldn't malloc space for outspace");
-    if ( (inspace = malloc(sizeof(float) * fftlen)) == NULL )
-        die("Couldn't malloc space for inspace");
+    while ( (b = spsc_pop(&j->done))->blocks ) {
+        writebatch(j, b);
+        spsc_push(&j->empty, b);
+    }
 
-    // plan forward and plan backward
-#ifdef USE_FFTW3
-    p_fw = fftwf_plan_dft_r2c_1d(fftlen, inspace,  f_out, FFTW_ESTIMATE);
-    p_bw = fftwf_plan_dft_c2r_1d(fftlen, f_out, revspace, FFTW_ESTIMATE);
-#else
-    cfg_fw = kiss_fftr_alloc(fftlen, 0, NULL, NULL);
-    cfg_bw = kiss_fftr_alloc(fftlen, 1, NULL, NULL);
-#endif
+    return NULL;
+}
 
+// the impulse response as spectra, from a sound file or a prepared spectra
+// file. inlength and inchannels are what it's planned for, 0 if unknown,
+// unless plan already holds the partitions. a sound file at another rate
+// than inrate is resampled to it, unless that's 0.
+static engine * loadengine(char *irpath, convopts *opts, int threads, int64_t inlength, int inchannels, int inrate,
+                           const planchoice *plan) {
+    engineopts eo = { opts->latency, threads, inlength, inchannels, opts->memcap, opts->direct, inrate, opts->trimdb,
+                      opts->precision, opts->planeffort, plan };
+    engine *e;
+    int err;
+
+    if ( (err = engine_new(&e, &eo)) )
+        die(engine_strerror(err));
+    if ( engine_prepare_file(e, irpath) )
+        diem(engine_lasterror(e), irpath);
+
+    const trimresult *t = engine_trim(e);
+    if ( opts->verbose && t && t->kept < t->frames )
+        fprintf(stderr, "impulse: trimmed from %d to %d frames, the last %d faded out\n", t->frames, t->kept, t->fade);
+    else if ( opts->verbose && t )
+        fprintf(stderr, "impulse: not trimmed\n");
+    if ( opts->verbose && t && opts->trimdb == TRIM_NOISEFLOOR )
+        fprintf(stderr, "impulse: noise floor %.1fdB under the peak\n", t->noisedb);
+
+    if ( opts->verbose && engine_plan(e) )
+        planner_print(stderr, "impulse", engine_plan(e));
+
+    return e;
+}
+
+// a message about one file that stops the run, or with a name just that file
+static int fileerror(char *name, const char *msg, char *path) {
+    if ( name )
+        fprintf(stderr, "%s: %s (%s)\n", name, msg, path);
+    else
+        fprintf(stderr, "%s (%s)\n", msg, path);
+    return -1;
+}
 
-    // set up the input add file
-    SNDFILE *s_add = NULL;
-    SF_INFO addinfo;
+// the input of a job, opened once for the whole of it, or NULL after saying why
+static soundin * openinput(char *inputpath, char *name, convopts *opts) {
+    statclock clock;
+    soundin *in;
+
+    stats_begin(&clock);
+    in = opts->rawchannels ? soundin_open_raw(inputpath, opts->rawchannels) : soundin_open(inputpath);
+    stats_end(&clock, STAT_OPEN);
+    if ( in == NULL )
+        fileerror(name, "Couldn't open a sound file for reading", inputpath);
+
+    return in;
+}
 
-    memset(&addinfo, 0, sizeof(addinfo));
+// convolve one input file into outputpath through e, which must not have
+// started yet. the caller opens and closes the input. name is NULL unless
+// several files run at once. returns -1 if the file couldn't be convolved,
+// after saying why.
+static int convolvefile(engine *e, soundin *in, char *inputpath, char *outputpath, char *name, convopts *opts) {
+    job j;
+
+    memset(&j, 0, sizeof(j));
+    j.amp = opts->amp;
+    j.normalize = opts->normalize;
+    j.name = name;
+    j.in = in;
+
+    int64_t snd_in_len = soundin_frames(in);
+    j.inchannels = soundin_channels(in);
+    j.insamplebytes = soundin_samplebytes(in);
+
+    // raw samples are taken to be at the impulse's rate
+    if ( soundin_samplerate(in) && soundin_samplerate(in) != engine_samplerate(e) )
+        return fileerror(name, "Sample rates of input and impulse response are different.", inputpath);
+
+    if ( engine_start(e, j.inchannels) )
+        return fileerror(name, engine_lasterror(e), inputpath);
+
+    int blocksize = engine_blocksize(e);
+    int irlen = engine_irlength(e);
+    int threads = opts->threads > 1 && name == NULL ? opts->threads : 1;
+
+    j.outchannels = engine_outchannels(e);
+
+    // every plan this job needs exists by now
+    fft_finish();
+
+    j.blocksize = blocksize;
+    j.outlen = snd_in_len + irlen;
+    j.steps = (j.outlen + blocksize - 1) / blocksize;
+
+#ifdef SPEW
+    const pcfilter *filter = engine_filter(e);
+    if ( name )
+        fprintf(stderr, "%s:\n", name);
+    fprintf(stderr, "using %s kernels, reading through %s\n", kernels_name(), soundin_backend(in));
+    for (int i = 0; i < filter->nstages; i++)
+        fprintf(stderr, "%d partitions of %d samples at %d\n", filter->stages[i].parts, filter->stages[i].blocksize, filter->stages[i].offset);
+    fprintf(stderr, "doing %lld steps of size %d\n", (long long) j.steps, blocksize);
+#endif
 
-    if ( addpath ) {
-        if ( (s_add = sf_open(addpath, SFM_READ, &addinfo)) == NULL )
-            die("Couldn't open additive file for reading");
+    // decoding and encoding overlap the engine on threads of their own,
+    // unless this is one file of a batch, where other files keep the cpus
+    // busy while this one waits on its codec
+    int overlap = name == NULL;
+
+    // each batch holds the same number of blocks for every worker
+    int batchblocks = threads;
+    while ( batchblocks * blocksize < BATCH_FRAMES )
+        batchblocks += threads;
+
+    batch batches[BATCH_BUFFERS];
+    int nbatches = overlap ? BATCH_BUFFERS : 1;
+
+    for (int i = 0; i < nbatches; i++) {
+        if ( (batches[i].in = malloc(sizeof(float) * batchblocks * blocksize * j.inchannels)) == NULL )
+            die("Couldn't malloc space for inspace");
+        if ( (batches[i].out = malloc(sizeof(float) * batchblocks * blocksize * j.outchannels)) == NULL )
+            die("Couldn't malloc space for outspace");
+        batches[i].blocks = batchblocks;
     }
 
     // set up the output file
-    SNDFILE *s_out;
     SF_INFO outinfo;
 
     memset(&outinfo, 0, sizeof(outinfo));
 
-    outinfo.samplerate = snd_in_info.samplerate;
-    outinfo.channels   = 1;
+    outinfo.samplerate = engine_samplerate(e);
+    outinfo.channels   = j.outchannels;
     outinfo.format     = SF_FORMAT_WAV | SF_FORMAT_PCM_24 | SF_ENDIAN_FILE;
 
-    if ( (s_out = sf_open(outputpath, SFM_WRITE, &outinfo)) == NULL )
-        die("Couldn't open output file for writing");
-
-    // copy the first few bytes of the add to the output, if we're delayed
-    if ( addpath ) {
-        int tocopy = extradelay;
-        while ( tocopy > 0 ) {
-            if ( tocopy > fftlen ) {
-                sf_read_float(s_add, outspace, fftlen);
-                sf_write_float(s_out, outspace, fftlen);
-                tocopy -= fftlen;
-            } else {
-                sf_read_float(s_add, outspace, tocopy);
-                sf_write_float(s_out, outspace, tocopy);
-                tocopy -= tocopy;
-            }
-        }
-    } else {
-        int tocopy = extradelay;
-        for (int i = 0; i < fftlen; i++)
-            outspace[i] = 0;
-        while ( tocopy > 0 ) {
-            if ( tocopy > fftlen ) {
-                sf_write_float(s_out, outspace, fftlen);
-                tocopy -= fftlen;
-            } else {
-                sf_write_float(s_out, outspace, tocopy);
-                tocopy -= tocopy;
-            }
+    // past what a wav's 32 bit sizes can hold, the same samples go in an rf64
+    if ( (uint64_t) j.outlen * j.outchannels * 3 > UINT32_MAX - 44 )
+        outinfo.format = SF_FORMAT_RF64 | SF_FORMAT_PCM_24 | SF_ENDIAN_FILE;
+
+    statclock clock;
+    stats_begin(&clock);
+    j.s_out = sf_open(outputpath, SFM_WRITE, &outinfo);
+    stats_end(&clock, STAT_OPEN);
+    if ( j.s_out == NULL ) {
+        for (int i = 0; i < nbatches; i++) {
+            free(batches[i].in);
+            free(batches[i].out);
         }
+        return fileerror(name, "Couldn't open output file for writing", outputpath);
     }
 
-    // take the fft of the impulse response
-#ifdef USE_FFTW3
-    for (int i = 0; i < fftlen; i++)
-        inspace[i] = i < ir->length ? ir->data[i] : 0;
-    fftwf_execute(p_fw);
-    memcpy(f_ir, f_out, sizeof(fftwf_complex) * (fftlen/2+1));
-#else
-    kiss_fftr(cfg_fw, ir->data, f_ir);
-#endif
+    if ( opts->scratch || opts->normalize ) {
+        char *scratchpath;
+        if ( (scratchpath = malloc(strlen(outputpath)+strlen(SCRATCH_SUFFIX)+1)) == NULL )
+            die("Couldn't malloc space for scratchpath");
+        strcpy(scratchpath, outputpath);
+        strcat(scratchpath, SCRATCH_SUFFIX);
 
-    // initialize the outspace
-    if ( addpath ) {
-        sf_read_float(s_add, outspace, fftlen);
-    } else {
-        for (int i = 0; i < fftlen; i++)
-            outspace[i] = 0;
-    }
+        j.scratch = accum_new(scratchpath, j.outlen, j.outchannels);
 
-    // initialize the inspace
-    for (int i = 0; i < fftlen; i++)
-        inspace[i] = 0;
+        free(scratchpath);
+    }
 
     // and go!
-    int totalclipped = 0;
-    float maxval = 0;
-    for (int st = 0; st < steps; st++) {
-        fprintf(stderr, "convoluting... %d/%d\033[K\r", st+1, steps);
-        int start = st*stepsize;
-
-        // read some amount from the input file
-        int readlength = stepsize;
-        if ( start + readlength > snd_in_len )
-            readlength = snd_in_len - start;
-        sf_read_float(snd_in, inspace, readlength);
-
-        // clean up the trailing part of inspace if it's the last step
-        if ( start+fftlen > snd_in_len )
-            for (int i = readlength+1; i < fftlen; i++)
-                inspace[i] = 0;
-
-        // take the fft
-#ifdef USE_FFTW3
-        fftwf_execute(p_fw);
-#else
-        kiss_fftr(cfg_fw, inspace, f_out);
-#endif
-
-        // multiply by f_ir
-        for (int i = 0; i < fftlen/2+1; i++) {
-#ifdef USE_FFTW3
-            float re = f_ir[i][0]*f_out[i][0] - f_ir[i][1]*f_out[i][1];
-            float im = f_ir[i][1]*f_out[i][0] + f_ir[i][0]*f_out[i][1];
-            f_out[i][0] = re;
-            f_out[i][1] = im;
-#else
-            float re = f_ir[i].r*f_out[i].r - f_ir[i].i*f_out[i].i;
-            float im = f_ir[i].i*f_out[i].r + f_ir[i].r*f_out[i].i;
-            f_out[i].r = re;
-            f_out[i].i = im;
-#endif
+    if ( overlap ) {
+        // a reader thread keeps batches coming, the engine convolves a whole
+        // batch at a time and a writer thread takes them back in order
+        pthread_t reader, writer;
+
+        spsc_init(&j.empty, nbatches);
+        spsc_init(&j.full, nbatches);
+        spsc_init(&j.done, nbatches);
+        for (int i = 0; i < nbatches; i++)
+            spsc_push(&j.empty, &batches[i]);
+
+        if ( pthread_create(&reader, NULL, readerthread, &j) )
+            die("Couldn't start reader thread");
+        if ( pthread_create(&writer, NULL, writerthread, &j) )
+            die("Couldn't start writer thread");
+
+        batch *b;
+        while ( (b = spsc_pop(&j.full))->blocks ) {
+            engine_process(e, b->in, b->out, b->blocks);
+            spsc_push(&j.done, b);
         }
+        spsc_push(&j.done, b);
 
-        // take the inverse fft
-#ifdef USE_FFTW3
-        fftwf_execute(p_bw);
-#else
-        kiss_fftri(cfg_bw, f_out, revspace);
-#endif
+        pthread_join(reader, NULL);
+        pthread_join(writer, NULL);
 
-        // add the resulting chunk to the outspace (normalizing it as we go)
-        for (int i = 0; i < fftlen; i++)
-            outspace[i] += revspace[i]/fftlen * amp;
+        spsc_destroy(&j.empty);
+        spsc_destroy(&j.full);
+        spsc_destroy(&j.done);
+    } else {
+        while ( j.readsteps < j.steps ) {
+            int blocks = j.steps - j.readsteps < batchblocks ? j.steps - j.readsteps : batchblocks;
+            readbatch(&j, &batches[0], blocks);
+            engine_process(e, batches[0].in, batches[0].out, blocks);
+            writebatch(&j, &batches[0]);
+        }
+    }
 
-        // get some clipping statistics
-        for (int i = 0; i < stepsize; i++) {
-            if ( fabs(outspace[i]) > maxval )
-                maxval = fabs(outspace[i]);
-            if ( fabs(outspace[i]) > 1 ) {
-                totalclipped++;
-                if ( outspace[i] > 0 ) {
-                    outspace[i] = 1;
-                } else {
-                    outspace[i] = -1;
-                }
+    if ( j.scratch ) {
+        float gain = 1;
+
+        if ( j.normalize && j.renderpeak > 0 ) {
+            float target = j.normalize == NORMALIZE_PEAK ? powf(10, opts->peakdb / 20) : 1;
+            if ( j.normalize == NORMALIZE_PEAK || j.renderpeak > target ) {
+                // rounded down, so the peak can't come out over the target
+                gain = nextafterf(target / j.renderpeak, 0);
             }
         }
 
-        // write out the part we're done with
-        if ( st < steps-1 ) {
-            sf_write_float(s_out, outspace, stepsize);
-        } else {
-            // write out the last step - it's smaller than the rest
-            sf_write_float(s_out, outspace, snd_in_len - stepsize*(steps-1) + ir->length);
-        }
-        
-        // and slide the outspace over
-        // TODO: memmove
-        for (int i = 0; i < fftlen-stepsize; i++) {
-            outspace[i] = outspace[i+stepsize];
-        }
+        if ( name == NULL )
+            fprintf(stderr, "\r\033[K");
+        encodescratch(&j, gain);
+        accum_free(j.scratch);
 
-        // finally, initialize the newly opened up space with more data from the add file
-        // append with zeroes if we're already past the end of the add file
-        int got = 0;
-        if ( addpath )
-            got = sf_read_float(s_add, &outspace[fftlen-stepsize], stepsize);
-        for (int i = fftlen-stepsize+got; i<fftlen; i++)
-            outspace[i] = 0;
+        if ( name )
+            fprintf(stderr, "%s: normalized by %f to a peak of %f\n", name, gain * j.amp, j.maxval);
+        else if ( j.normalize )
+            fprintf(stderr, "\r\033[Knormalized by %f to a peak of %f\n", gain * j.amp, j.maxval);
     }
 
-    fprintf(stderr, "\r\033[K");
-
-    // finalize the clipping statistics
-    for (int i = 0; i < fftlen; i++) {
-        if ( fabs(outspace[i]) > maxval )
-            maxval = fabs(outspace[i]);
-        if ( fabs(outspace[i]) > 1 ) {
-            totalclipped++;
-            if ( outspace[i] > 0 ) {
-                outspace[i] = 1;
-            } else {
-                outspace[i] = -1;
-            }
-        }
-    }
+    if ( name == NULL )
+        fprintf(stderr, "\r\033[K");
 
     // and tell the user about them, if neccessary
-    if ( totalclipped ) {
-        fprintf(stderr, "WARNING: %d samples got clipped!\n", totalclipped);
-        fprintf(stderr, "Recommend a multipler of less than %f instead\n", amp/maxval);
+    if ( j.totalclipped ) {
+        if ( name )
+            fprintf(stderr, "WARNING: %s: %lld samples got clipped!\n", name, (long long) j.totalclipped);
+        else
+            fprintf(stderr, "WARNING: %lld samples got clipped!\n", (long long) j.totalclipped);
+        if ( j.normalize )
+            fprintf(stderr, "Recommend a peak target of at most 0 dBFS instead\n");
+        else
+            fprintf(stderr, "Recommend a multipler of less than %f instead\n", j.amp/j.maxval);
 #ifndef SPEW
-        fprintf(stderr, "maximum amplitude: %f\n", maxval);
+        fprintf(stderr, "maximum amplitude: %f\n", j.maxval);
 #endif
     }
 #ifdef SPEW
-    fprintf(stderr, "maximum amplitude: %f\n", maxval);
+    fprintf(stderr, "maximum amplitude: %f\n", j.maxval);
 #endif
 
     // clean up
-    sf_close(s_out);
-
-#ifdef USE_FFTW3
-    fftwf_destroy_plan(p_fw);
-    fftwf_destroy_plan(p_bw);
-    fftwf_free(f_out);
-    fftwf_free(f_ir);
-    fftwf_free(revspace);
-#else
-    kiss_fftr_free(cfg_fw);
-    kiss_fftr_free(cfg_bw);
-    KISS_FFT_FREE(f_ir);
-    KISS_FFT_FREE(f_out);
-    KISS_FFT_FREE(revspace);
-#endif
+    sf_close(j.s_out);
+
+    for (int i = 0; i < nbatches; i++) {
+        free(batches[i].in);
+        free(batches[i].out);
+    }
+
+    stats_pass();
+
+    return 0;
+}
+
+static void partconvolute(soundin *in, char *inputpath, char *irpath, char *outputpath, convopts *opts,
+                          const planchoice *plan) {
+    engine *e = loadengine(irpath, opts, opts->threads, soundin_frames(in), soundin_channels(in), soundin_samplerate(in),
+                           plan);
+
+    if ( convolvefile(e, in, inputpath, outputpath, NULL, opts) )
+        exit(EXIT_FAILURE);
 
-    free(ir->data);
-    free(ir);
+    engine_free(e);
+}
 
-    sf_close(snd_in);
-    if ( addpath )
-        sf_close(s_add);
+static void put16(unsigned char *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
 
+static void put32(unsigned char *p, uint32_t v) {
+    put16(p, v);
+    put16(&p[2], v >> 16);
+}
+
+// the header of a wav of float samples. a stream's length isn't known until
+// it ends, so the sizes start out at their maximum, which readers take to
+// mean it runs to the end of the file.
+static void wavheader(unsigned char *h, int channels, int samplerate, uint32_t datalen) {
+    memcpy(h, "RIFF", 4);
+    put32(&h[4], datalen > UINT32_MAX - 36 ? UINT32_MAX : datalen + 36);
+    memcpy(&h[8], "WAVEfmt ", 8);
+    put32(&h[16], 16);
+    put16(&h[20], 3); // ieee float
+    put16(&h[22], channels);
+    put32(&h[24], samplerate);
+    put32(&h[28], samplerate * channels * 4);
+    put16(&h[32], channels * 4);
+    put16(&h[34], 32);
+    memcpy(&h[36], "data", 4);
+    put32(&h[40], datalen);
+}
+
+// wav and raw streams carry little endian samples
+static void tolittleendian(float *data, int samples) {
+    const uint32_t one = 1;
+    if ( *(const unsigned char *) &one )
+        return;
+
+    for (int i = 0; i < samples; i++) {
+        unsigned char *p = (unsigned char *) &data[i], t;
+        t = p[0]; p[0] = p[3]; p[3] = t;
+        t = p[1]; p[1] = p[2]; p[2] = t;
+    }
+}
+
+// convolve a stream of unknown length, from stdin if inputpath is "-" and
+// to stdout if outputpath is NULL. memory use depends on the impulse alone:
+// input is taken a fixed number of blocks at a time until it runs out, then
+// the tail of the impulse follows.
+static void streamconvolute(soundin *snd_in, char *inputpath, char *irpath, char *outputpath, convopts *opts) {
+    FILE *out;
+
+    if ( opts->scratch || opts->normalize )
+        die("A stream can't be normalized or rendered through a scratch file");
+
+    int64_t inframes = soundin_frames(snd_in);
+    engine *e = loadengine(irpath, opts, opts->threads, inframes > 0 ? inframes : 0, soundin_channels(snd_in),
+                           soundin_samplerate(snd_in), NULL);
+
+    int samplerate = engine_samplerate(e);
+    if ( soundin_samplerate(snd_in) && soundin_samplerate(snd_in) != samplerate )
+        diem("Sample rates of input and impulse response are different.", inputpath);
+    if ( engine_start(e, soundin_channels(snd_in)) )
+        diem(engine_lasterror(e), inputpath);
+
+    statclock clock;
+
+    stats_begin(&clock);
+    out = outputpath ? fopen(outputpath, "wb") : stdout;
+    stats_end(&clock, STAT_OPEN);
+    if ( out == NULL )
+        diem("Couldn't open output file for writing", outputpath);
+
+    int inch = soundin_channels(snd_in);
+    int outch = engine_outchannels(e);
+    int blocksize = engine_blocksize(e);
+    int batchblocks = opts->threads;
+    float *in, *outspace;
+
+    if ( (in = malloc(sizeof(float) * batchblocks * blocksize * inch)) == NULL )
+        die("Couldn't malloc space for inspace");
+    if ( (outspace = malloc(sizeof(float) * batchblocks * blocksize * outch)) == NULL )
+        die("Couldn't malloc space for outspace");
+
+    unsigned char header[44];
+    if ( !opts->rawchannels ) {
+        wavheader(header, outch, samplerate, UINT32_MAX);
+        if ( fwrite(header, sizeof(header), 1, out) != 1 )
+            die("Couldn't write output");
+    }
+
+    // the same length a file of the input would come out as
+    uint64_t inlen = 0, written = 0, outlen;
+    int64_t totalclipped = 0;
+    float maxval = 0;
+    int got;
+
+    do {
+        stats_begin(&clock);
+        got = soundin_read(snd_in, in, batchblocks * blocksize);
+        stats_end(&clock, STAT_DECODE);
+        stats_bytes((uint64_t) got * inch * soundin_samplebytes(snd_in), 0);
+        inlen += got;
+        outlen = inlen + engine_irlength(e);
+
+        int blocks = (got + blocksize - 1) / blocksize;
+        for (int i = got*inch; i < blocks*blocksize*inch; i++)
+            in[i] = 0;
+        engine_process(e, in, outspace, blocks);
+
+        // and the tail, once the input has ended
+        int frames = blocks * blocksize;
+        if ( got < batchblocks * blocksize ) {
+            for (; frames < batchblocks * blocksize && written + frames < outlen; frames += blocksize) {
+                int ignored;
+                engine_flush(e, &outspace[frames*outch], &ignored);
+            }
+        }
+        if ( (uint64_t) frames > outlen - written )
+            frames = outlen - written;
+
+        stats_begin(&clock);
+        totalclipped += kernels.clippeak(outspace, frames * outch, opts->amp, &maxval);
+        stats_end(&clock, STAT_CLIP);
+
+        stats_begin(&clock);
+        tolittleendian(outspace, frames * outch);
+        if ( fwrite(outspace, sizeof(float) * outch, frames, out) != (size_t) frames )
+            die("Couldn't write output");
+        stats_end(&clock, STAT_ENCODE);
+        stats_bytes(0, (uint64_t) frames * outch * sizeof(float));
+        written += frames;
+    } while ( written < outlen );
+
+    // a file can have its sizes filled in after all
+    if ( !opts->rawchannels && fseeko(out, 0, SEEK_SET) == 0 ) {
+        uint64_t datalen = written * outch * sizeof(float);
+        wavheader(header, outch, samplerate, datalen > UINT32_MAX ? UINT32_MAX : datalen);
+        if ( fwrite(header, sizeof(header), 1, out) != 1 )
+            die("Couldn't write output");
+    }
+
+    if ( fflush(out) || (out != stdout && fclose(out)) )
+        die("Couldn't write output");
+
+    stats_pass();
+
+    fft_finish();
+
+    if ( totalclipped ) {
+        fprintf(stderr, "WARNING: %lld samples got clipped!\n", (long long) totalclipped);
+        fprintf(stderr, "Recommend a multipler of less than %f instead\n", opts->amp/maxval);
+    }
+
+    engine_free(e);
+    free(in);
     free(outspace);
-    free(inspace);
 }
 
 void killfile(char *path) {
@@ -383,43 +634,400 @@ void killfile(char *path) {
     }
 }
 
-void convolute(char *inputpath, char *irpath, char *outputpath, float amp) {
+// one input/output pair of a batch
+typedef struct {
+    char *input;
+    char *output;
+    int64_t frames; // of input, to schedule the longest first
+    int rate;       // of input, 0 for raw input or where it doesn't matter
+} batchfile;
+
+// the impulse response prepared at one input rate, for every file's engine to borrow
+typedef struct {
+    int rate;
+    engine *e;
+} sharedengine;
+
+typedef struct {
+    char *irpath;
+    sharedengine *shared; // one per input rate so far
+    int nshared;
+    convopts *opts;
+    batchfile *files;
+    int nfiles;
+    int done;
+    int failed;
+    pthread_mutex_t lock;
+} batchrun;
+
+static int longestfirst(const void *a, const void *b) {
+    const batchfile *fa = a, *fb = b;
+    return (fb->frames > fa->frames) - (fb->frames < fa->frames);
+}
+
+// the shared engine for a file's rate, prepared the first time a file at
+// that rate comes up. files are handed out longest first, so it's planned
+// for the longest of them.
+static engine * sharedfor(batchrun *r, batchfile *f) {
+    engine *e = NULL;
+
+    pthread_mutex_lock(&r->lock);
+    for (int i = 0; i < r->nshared && e == NULL; i++)
+        if ( r->shared[i].rate == f->rate )
+            e = r->shared[i].e;
+    if ( e == NULL ) {
+        e = loadengine(r->irpath, r->opts, 1, f->frames, 0, f->rate, NULL);
+        r->shared[r->nshared].rate = f->rate;
+        r->shared[r->nshared].e = e;
+        r->nshared++;
+    }
+    pthread_mutex_unlock(&r->lock);
+
+    return e;
+}
+
+static void batchtask(void *ctx, int task, int worker) {
+    batchrun *r = ctx;
+    batchfile *f = &r->files[task];
     char *newpath;
 
-    if ( (newpath = malloc(strlen(outputpath)+strlen(TEMPORARY_SUFFIX))) == NULL )
+    if ( (newpath = malloc(strlen(f->output)+strlen(TEMPORARY_SUFFIX)+1)) == NULL )
+        die("Couldn't malloc space for newpath");
+    strcpy(newpath, f->output);
+    strcat(newpath, TEMPORARY_SUFFIX);
+
+    killfile(newpath);
+
+    // each file runs on a single thread, the pool spreads the files. one
+    // that can't be convolved is skipped rather than ending the batch.
+    engine *e = NULL;
+    soundin *in = NULL;
+    int err = engine_clone(&e, sharedfor(r, f));
+    if ( err )
+        fileerror(f->output, engine_strerror(err), f->input);
+    else if ( (in = openinput(f->input, f->output, r->opts)) == NULL )
+        err = -1;
+    else
+        err = convolvefile(e, in, f->input, newpath, f->output, r->opts);
+    soundin_close(in);
+    engine_free(e);
+
+    if ( err )
+        unlink(newpath);
+    else if ( rename(newpath, f->output) )
+        diem("Couldn't rename temporary file into place", f->output);
+
+    free(newpath);
+
+    pthread_mutex_lock(&r->lock);
+    r->done++;
+    if ( err )
+        r->failed++;
+    else
+        fprintf(stderr, "%d/%d %s\n", r->done, r->nfiles, f->output);
+    pthread_mutex_unlock(&r->lock);
+}
+
+// what a path names, so that two spellings of the same file compare equal:
+// its device and inode if it exists, otherwise its directory's and its name
+typedef struct {
+    int exists;
+    dev_t dev;
+    ino_t ino;
+    const char *name; // for a file yet to be made
+    const char *path;
+    int output;
+} fileid;
+
+static void identify(fileid *id, const char *path, int output) {
+    struct stat st;
+
+    memset(id, 0, sizeof(*id));
+    id->path = path;
+    id->output = output;
+
+    if ( stat(path, &st) == 0 ) {
+        id->exists = 1;
+        id->dev = st.st_dev;
+        id->ino = st.st_ino;
+        return;
+    }
+
+    const char *slash = strrchr(path, '/');
+    char *dir = slash ? strndup(path, slash == path ? 1 : slash - path) : strdup(".");
+    if ( dir == NULL )
+        die("Couldn't malloc space for a directory name");
+    id->name = slash ? slash + 1 : path;
+    if ( stat(dir, &st) == 0 ) {
+        id->dev = st.st_dev;
+        id->ino = st.st_ino;
+    } else {
+        // a directory that isn't there fails when the output is opened,
+        // until then it only matches its own spelling
+        id->name = path;
+    }
+    free(dir);
+}
+
+static int compareids(const void *a, const void *b) {
+    const fileid *x = a, *y = b;
+
+    if ( x->exists != y->exists )
+        return x->exists - y->exists;
+    if ( x->dev != y->dev )
+        return x->dev < y->dev ? -1 : 1;
+    if ( x->ino != y->ino )
+        return x->ino < y->ino ? -1 : 1;
+    if ( !x->exists ) {
+        int c = strcmp(x->name, y->name);
+        if ( c )
+            return c;
+    }
+    // inputs before outputs, so an input's collision is the one reported
+    return x->output - y->output;
+}
+
+// every output is renamed into place over whatever is there, so one that
+// is also an input, the impulse or another output would lose data. they
+// are all refused before anything starts.
+static void checkoutputs(char *irpath, char **inputs, char **outputs, int nfiles) {
+    fileid *ids;
+    int n = 0;
+
+    if ( (ids = malloc(sizeof(fileid) * (2*nfiles + 1))) == NULL )
+        die("Couldn't malloc space for checking output paths");
+
+    identify(&ids[n++], irpath, 0);
+    for (int i = 0; i < nfiles; i++) {
+        identify(&ids[n++], inputs[i], 0);
+        identify(&ids[n++], outputs[i], 1);
+    }
+    qsort(ids, n, sizeof(fileid), compareids);
+
+    for (int i = 1; i < n; i++) {
+        fileid a = ids[i-1], b = ids[i];
+        a.output = b.output = 0;
+        if ( !ids[i].output || compareids(&a, &b) )
+            continue;
+
+        if ( ids[i-1].output )
+            fprintf(stderr, "%s and %s are the same output\n", ids[i-1].path, ids[i].path);
+        else
+            fprintf(stderr, "Output %s would overwrite %s\n", ids[i].path, ids[i-1].path);
+        exit(EXIT_FAILURE);
+    }
+
+    free(ids);
+}
+
+int convolutebatch(char *irpath, char **inputs, char **outputs, int nfiles, convopts *opts) {
+    batchrun r;
+
+    checkoutputs(irpath, inputs, outputs, nfiles);
+
+    memset(&r, 0, sizeof(r));
+    r.irpath = irpath;
+    r.opts = opts;
+    r.nfiles = nfiles;
+    pthread_mutex_init(&r.lock, NULL);
+
+    if ( (r.files = malloc(sizeof(batchfile) * nfiles)) == NULL || (r.shared = malloc(sizeof(sharedengine) * (nfiles + 1))) == NULL )
+        die("Couldn't malloc space for batch");
+
+    // a spectra file is only good at its own rate, so files at any other
+    // are reported as mismatched. raw input is taken at the impulse's.
+    int anyrate = opts->rawchannels || spectrafile_is(irpath);
+
+    for (int i = 0; i < nfiles; i++) {
+        r.files[i].input = inputs[i];
+        r.files[i].output = outputs[i];
+        r.files[i].frames = getsoundfilelength(inputs[i]);
+        r.files[i].rate = anyrate ? 0 : getsoundfilesamplerate(inputs[i]);
+        if ( r.files[i].rate < 0 )
+            r.files[i].rate = 0;
+    }
+
+    // handing out the longest files first keeps one long straggler from
+    // running alone at the end
+    qsort(r.files, nfiles, sizeof(batchfile), longestfirst);
+
+    // the impulse is decoded and transformed once for each input rate, and
+    // resampled to it where it differs
+    fft_init(opts->planning);
+
+    pool *workers;
+    if ( (workers = pool_new(opts->threads)) == NULL )
+        die("Couldn't start worker threads");
+    pool_run(workers, batchtask, &r, nfiles);
+    pool_free(workers);
+
+    for (int i = 0; i < r.nshared; i++)
+        engine_free(r.shared[i].e);
+    free(r.shared);
+    free(r.files);
+    pthread_mutex_destroy(&r.lock);
+
+    return r.failed;
+}
+
+int readmanifest(char *path, char ***inputs, char ***outputs) {
+    FILE *f;
+    char *line = NULL;
+    size_t linesize = 0;
+    int n = 0, size = 0;
+
+    if ( (f = fopen(path, "r")) == NULL )
+        diem("Couldn't open manifest", path);
+
+    *inputs = *outputs = NULL;
+
+    while ( getline(&line, &linesize, f) != -1 ) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if ( line[0] == '\0' || line[0] == '#' )
+            continue;
+
+        // paths are separated by a tab, or by spaces if there is no tab
+        char *sep = strchr(line, '\t');
+        if ( sep == NULL )
+            sep = strchr(line, ' ');
+        if ( sep == NULL )
+            diem("Manifest line without an output path", line);
+
+        char *out = sep + strspn(sep, " \t");
+        *sep = '\0';
+        if ( *out == '\0' )
+            diem("Manifest line without an output path", line);
+
+        if ( n == size ) {
+            size = size ? size*2 : 64;
+            if ( (*inputs = realloc(*inputs, sizeof(char*) * size)) == NULL ||
+                 (*outputs = realloc(*outputs, sizeof(char*) * size)) == NULL )
+                die("Couldn't malloc space for manifest");
+        }
+
+        if ( ((*inputs)[n] = strdup(line)) == NULL || ((*outputs)[n] = strdup(out)) == NULL )
+            die("Couldn't malloc space for manifest");
+        n++;
+    }
+
+    free(line);
+    fclose(f);
+
+    return n;
+}
+
+void convolute(char *inputpath, char *irpath, char *outputpath, convopts *opts) {
+    char *newpath;
+    soundin *in, *ir = NULL;
+
+    fft_init(opts->planning);
+
+    // the input is opened once, for everything from planning to the last block
+    if ( (in = openinput(inputpath, NULL, opts)) == NULL )
+        exit(EXIT_FAILURE);
+
+    // neither a pipe's length nor its end can be known up front
+    if ( strcmp(outputpath, "-") == 0 ) {
+        streamconvolute(in, inputpath, irpath, NULL, opts);
+        soundin_close(in);
+        return;
+    }
+
+    if ( (newpath = malloc(strlen(outputpath)+strlen(TEMPORARY_SUFFIX)+1)) == NULL )
         die("Couldn't malloc space for newpath");
 
     strcpy(newpath, outputpath);
     strcpy(&newpath[strlen(outputpath)], TEMPORARY_SUFFIX);
 
-    killfile(outputpath);
     killfile(newpath);
 
-    int irlen = getsoundfilelength(irpath);
-    int inlen = getsoundfilelength(inputpath);
-
-    if ( irlen > inlen ) {
-#ifdef SPEW
-        fprintf(stderr, "swapping ir and in\n");
-#endif
-        return convolute(irpath, inputpath, outputpath, amp);
+    if ( strcmp(inputpath, "-") == 0 ) {
+        streamconvolute(in, inputpath, irpath, newpath, opts);
+        soundin_close(in);
+        if ( rename(newpath, outputpath) )
+            die("Couldn't rename temporary file into place");
+        free(newpath);
+        return;
     }
 
-    int passes = (int) ceil( (double)irlen / IMPULSE_CHUNK_MAXLEN );
-
-    int i = 0;
-    int irat = 0;
-    while ( irat < irlen ) {
-        if ( passes > 1 )
-            fprintf(stderr, "pass %d/%d\033[K\n", i+1, passes);
+    // with a latency target the roles matter: the impulse is what gets
+    // partitioned. a prepared impulse can't swap either, nor can raw input,
+    // which only has a sample rate next to an impulse, nor files at
+    // different rates, where the impulse is resampled to keep the input's,
+    // nor when the impulse is to be trimmed. otherwise the planner costs
+    // both orientations and keeps the cheaper one.
+    planchoice kept, swapped, *plan = NULL;
+    if ( !opts->latency && !opts->rawchannels && !opts->trimdb && !spectrafile_is(irpath) )
+        ir = soundin_open(irpath);
+    if ( ir && soundin_frames(in) > 0 && soundin_frames(ir) > 0 && soundin_samplerate(in) == soundin_samplerate(ir) ) {
+        planinput pi = { soundin_frames(ir), soundin_channels(ir), soundin_frames(in), soundin_channels(in),
+                         0, opts->threads, opts->memcap, opts->direct, opts->precision, opts->planeffort };
+        int swap = planner_swap(&pi, &kept, &swapped);
+        plan = swap ? &swapped : &kept;
+
+        if ( opts->verbose ) {
+            planner_print(stderr, "as given", &kept);
+            planner_print(stderr, "swapped", &swapped);
+            fprintf(stderr, "%s\n", swap ? "swapping input and impulse" : "keeping input and impulse");
+        }
 
-        addconvolute(inputpath, irpath, i == 0 ? NULL : outputpath, newpath, amp, irat);
-        irat += IMPULSE_CHUNK_MAXLEN;
-        rename(newpath, outputpath);
+        if ( swap ) {
+            char *t = inputpath;
+            inputpath = irpath;
+            irpath = t;
 
-        i++;
+            soundin *ts = in;
+            in = ir;
+            ir = ts;
+        }
     }
 
+    // the engine reads the impulse itself
+    soundin_close(ir);
+
+    // the input and output are each streamed exactly once, however long the
+    // impulse response is. the result only replaces outputpath once complete.
+    // whichever way round, the impulse has been planned for this input already
+    partconvolute(in, inputpath, irpath, newpath, opts, plan);
+    soundin_close(in);
+
+    if ( rename(newpath, outputpath) )
+        die("Couldn't rename temporary file into place");
+
     free(newpath);
 }
 
+void prepare(char *irpath, char *spectrapath, convopts *opts) {
+    char *newpath;
+
+    if ( (newpath = malloc(strlen(spectrapath)+strlen(TEMPORARY_SUFFIX)+1)) == NULL )
+        die("Couldn't malloc space for newpath");
+
+    strcpy(newpath, spectrapath);
+    strcat(newpath, TEMPORARY_SUFFIX);
+
+    killfile(newpath);
+
+    fft_init(opts->planning);
+
+    // a spectra file only holds partitions
+    opts->direct = -1;
+    engine *e = loadengine(irpath, opts, 1, 0, 0, opts->samplerate, NULL);
+
+    if ( engine_save(e, newpath) )
+        diem(engine_lasterror(e), newpath);
+
+    if ( rename(newpath, spectrapath) )
+        die("Couldn't rename temporary file into place");
+
+    const pcfilter *filter = engine_filter(e);
+    int parts = 0;
+    for (int i = 0; i < filter->nstages; i++)
+        parts += filter->stages[i].parts;
+    fprintf(stderr, "%d partitions in %d stages, hash %016llx\n", parts, filter->nstages, (unsigned long long) engine_hash(e));
+
+    fft_finish();
+
+    engine_free(e);
+    free(newpath);
+}
@@ -17,7 +17,52 @@
 #ifndef __CONVOLUTE_H__
 #define __CONVOLUTE_H__
 
-void convolute(char *inputpath, char *irpath, char *outputpath, float amp);
+// what to do with the output's level once the whole convolution is known
+#define NORMALIZE_OFF    0
+#define NORMALIZE_PEAK   1 // scale it so the peak lands on peakdb dBFS
+#define NORMALIZE_NOCLIP 2 // scale it down only as far as it takes to not clip
+
+typedef struct {
+    float amp;
+    int latency; // 0 for offline use, otherwise the smallest partition size in samples
+    int threads; // convolution threads, not counting the reader and writer
+    int scratch; // render into a float scratch file and encode once at the end
+    int planning; // FFT_ESTIMATE, FFT_MEASURE or FFT_PATIENT
+    int planeffort; // the same for the partition size, see planner.h
+    int normalize; // one of the NORMALIZE_ modes, renders through the scratch accumulator
+    float peakdb;
+    int rawchannels; // the input is headerless little endian floats of this many channels
+    size_t memcap; // bytes the partitioned side may take, 0 for no limit
+    int verbose; // print what the planner decided
+    int direct; // 1 to convolve in the time domain whatever the impulse length, -1 never
+    int samplerate; // for prepare, the rate to resample the impulse response to, 0 for its own
+    float trimdb; // cut the impulse response where its decay falls this many dB, or TRIM_NOISEFLOOR, or 0
+    int precision; // how the partitioned side's spectra are stored, one of the PC_ formats in partconv.h
+} convopts;
+
+// an impulse response at another sample rate than the input is resampled
+// to the input's as it's prepared, and the output comes out at that rate.
+// an input or output path of - streams from stdin or to stdout, which
+// works on input of any length in memory bounded by the impulse response.
+// a wav stream comes out as a wav of floats, a raw one as raw floats.
+void convolute(char *inputpath, char *irpath, char *outputpath, convopts *opts);
+
+// convolves every inputs[i] into outputs[i] against one impulse response,
+// which is only loaded once. the files are spread over opts->threads threads.
+// a file that can't be convolved is reported and skipped; returns how many were.
+// an output that names an input, the impulse or another output stops the
+// batch before it starts.
+int convolutebatch(char *irpath, char **inputs, char **outputs, int nfiles, convopts *opts);
+
+// reads a manifest of input and output paths, one pair per line separated
+// by a tab or spaces. blank lines and lines starting with # are skipped.
+// returns the number of pairs.
+int readmanifest(char *path, char ***inputs, char ***outputs);
+
+// partitions and transforms an impulse response once into a spectra file,
+// which convolute then takes in place of it. uses the latency, planning and
+// sample rate options.
+void prepare(char *irpath, char *spectrapath, convopts *opts);
 
 #endif
 
@@ -0,0 +1,406 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "engine.h"
+#include "pool.h"
+#include "readsoundfile.h"
+#include "resample.h"
+#include "trim.h"
+#include "spectrafile.h"
+#include "stats.h"
+
+struct engine {
+    engineopts opts;
+    pool *workers;
+
+    pcfilter *filter;
+    int ownsfilter;   // clones borrow their source's
+    int samplerate;
+    uint64_t hash;
+    planchoice plan;  // how a prepared impulse response was partitioned
+    trimresult trim;  // and where it was cut, when trimming was asked for
+
+    partconv *pc;
+    float *silence;   // one block of input for engine_flush
+    int tail;         // frames of convolution left after the last input
+
+    const char *why;
+};
+
+const char * engine_strerror(int err) {
+    switch ( err ) {
+        case ENGINE_OK:        return "Success";
+        case ENGINE_ENOMEM:    return "Out of memory";
+        case ENGINE_EIO:       return "Couldn't read or write a file";
+        case ENGINE_EFORMAT:   return "Not a usable sound or spectra file";
+        case ENGINE_ECHANNELS: return "Input and impulse response channel counts don't match, and neither is mono";
+        case ENGINE_ESTATE:    return "Engine called out of order";
+        case ENGINE_EARG:      return "Bad argument";
+    }
+    return "Unknown error";
+}
+
+// records the details of a failure for engine_lasterror
+static int fail(engine *e, int err, const char *why) {
+    e->why = why ? why : engine_strerror(err);
+    return err;
+}
+
+int engine_new(engine **ep, const engineopts *opts) {
+    engine *e;
+
+    *ep = NULL;
+
+    if ( opts && opts->latency < 0 )
+        return ENGINE_EARG;
+    if ( opts && opts->precision != PC_FLOAT32 && opts->precision != PC_FLOAT16 && opts->precision != PC_BFLOAT16 )
+        return ENGINE_EARG;
+
+    if ( (e = calloc(1, sizeof(*e))) == NULL )
+        return ENGINE_ENOMEM;
+
+    if ( opts )
+        e->opts = *opts;
+    if ( e->opts.threads < 1 )
+        e->opts.threads = 1;
+
+    if ( e->opts.threads > 1 && (e->workers = pool_new(e->opts.threads)) == NULL ) {
+        free(e);
+        return ENGINE_ENOMEM;
+    }
+
+    *ep = e;
+    return ENGINE_OK;
+}
+
+int engine_clone(engine **ep, engine *src) {
+    engineopts opts = src->opts;
+    int err;
+
+    *ep = NULL;
+
+    if ( src->filter == NULL )
+        return fail(src, ENGINE_ESTATE, "Cloning an engine with no impulse response");
+
+    opts.threads = 1;
+    opts.plan = NULL;
+    if ( (err = engine_new(ep, &opts)) )
+        return err;
+
+    (*ep)->filter = src->filter;
+    (*ep)->samplerate = src->samplerate;
+    (*ep)->hash = src->hash;
+    (*ep)->plan = src->plan;
+    (*ep)->trim = src->trim;
+
+    return ENGINE_OK;
+}
+
+// swaps in a new filter, which the engine then owns
+static void setfilter(engine *e, pcfilter *f, int samplerate, uint64_t hash) {
+    if ( e->ownsfilter )
+        pcfilter_free(e->filter);
+    e->filter = f;
+    e->ownsfilter = 1;
+    memset(&e->plan, 0, sizeof(e->plan));
+    memset(&e->trim, 0, sizeof(e->trim));
+    e->samplerate = samplerate;
+    e->hash = hash;
+}
+
+// the impulse response at the rate wanted of it, into a new buffer
+static int resampleir(engine *e, const float *ir, int *frames, int channels, int samplerate, float **out) {
+    resampler *r;
+    statclock clock;
+
+    stats_begin(&clock);
+    if ( (r = resampler_new(samplerate, e->opts.samplerate)) == NULL )
+        return fail(e, ENGINE_ENOMEM, "Couldn't set up resampling of the impulse response");
+
+    int64_t outframes = resampler_outframes(r, *frames);
+    if ( outframes > INT_MAX ) {
+        resampler_free(r);
+        return fail(e, ENGINE_EFORMAT, "Impulse response is too long");
+    }
+    if ( (*out = malloc(sizeof(float) * outframes * channels)) == NULL || resampler_run(r, ir, *frames, channels, *out) ) {
+        free(*out);
+        resampler_free(r);
+        return fail(e, ENGINE_ENOMEM, "Couldn't allocate the resampled impulse response");
+    }
+    resampler_free(r);
+
+    // the same gain per hertz over fewer or more samples a second
+    float scale = (float) samplerate / e->opts.samplerate;
+    for (size_t i = 0; i < (size_t) outframes * channels; i++)
+        (*out)[i] *= scale;
+
+    *frames = outframes;
+    stats_end(&clock, STAT_RESAMPLE);
+
+    return ENGINE_OK;
+}
+
+int engine_prepare(engine *e, const float *ir, int frames, int channels, int samplerate) {
+    pcfilter *f;
+    float *copy = NULL; // the impulse once resampled or trimmed, which the caller's can't be
+    trimresult trim;
+    int err;
+
+    if ( e->pc )
+        return fail(e, ENGINE_ESTATE, "Preparing an engine that has already started");
+    if ( frames < 1 || channels < 1 || samplerate < 1 )
+        return fail(e, ENGINE_EARG, "Impulse response is empty");
+
+    if ( e->opts.samplerate && samplerate != e->opts.samplerate ) {
+        if ( (err = resampleir(e, ir, &frames, channels, samplerate, &copy)) )
+            return err;
+        ir = copy;
+        samplerate = e->opts.samplerate;
+    }
+
+    // cut before planning, so the noise after the decay costs nothing
+    if ( e->opts.trimdb ) {
+        trim_find(ir, frames, channels, samplerate, e->opts.trimdb, &trim);
+        if ( trim.kept < frames ) {
+            if ( copy == NULL ) {
+                if ( (copy = malloc(sizeof(float) * trim.kept * channels)) == NULL )
+                    return fail(e, ENGINE_ENOMEM, "Couldn't allocate the trimmed impulse response");
+                memcpy(copy, ir, sizeof(float) * trim.kept * channels);
+            }
+            trim_fade(copy, channels, &trim);
+            ir = copy;
+            frames = trim.kept;
+        }
+        stats_trim(trim.frames, trim.kept);
+    }
+
+    int latency = e->opts.latency;
+    statclock clock;
+    planinput pi = { frames, channels, e->opts.inlength, e->opts.inchannels, latency, e->opts.threads, e->opts.memcap,
+                     e->opts.direct, e->opts.precision, e->opts.planning };
+    planchoice plan;
+
+    // a low latency filter grows its partitions up to the size a uniform
+    // one would have used
+    if ( e->opts.plan && copy == NULL )
+        plan = *e->opts.plan;
+    else
+        planner_choose(&pi, &plan);
+
+    stats_begin(&clock);
+    if ( plan.direct )
+        f = pcfilter_new_direct(ir, frames, channels, plan.blocksize);
+    else if ( !latency )
+        f = pcfilter_new(ir, frames, channels, plan.blocksize, e->opts.precision);
+    else
+        f = pcfilter_new_lowlatency(ir, frames, channels, latency, plan.blocksize, e->opts.precision);
+    stats_end(&clock, STAT_IRFFT);
+
+    if ( f == NULL ) {
+        free(copy);
+        return fail(e, ENGINE_ENOMEM, "Couldn't allocate the impulse response's spectra");
+    }
+
+    setfilter(e, f, samplerate, spectrafile_hash(ir, (size_t) frames * channels, channels, samplerate));
+    e->plan = plan;
+    if ( e->opts.trimdb )
+        e->trim = trim;
+    free(copy);
+
+    return ENGINE_OK;
+}
+
+int engine_prepare_file(engine *e, const char *path) {
+    statclock clock;
+    struct stat st;
+
+    if ( e->pc )
+        return fail(e, ENGINE_ESTATE, "Preparing an engine that has already started");
+
+    if ( stats_on && stat(path, &st) == 0 )
+        stats_bytes(st.st_size, 0);
+
+    stats_begin(&clock);
+    if ( spectrafile_is(path) ) {
+        // partitioned and transformed ahead of time by engine_save
+        const char *why;
+        int samplerate;
+        uint64_t hash;
+        pcfilter *f = spectrafile_map(path, &samplerate, &hash, &why);
+        stats_end(&clock, STAT_IRREAD);
+
+        if ( f == NULL )
+            return fail(e, ENGINE_EFORMAT, why);
+
+        if ( e->opts.latency && e->opts.latency != f->latency ) {
+            pcfilter_free(f);
+            return fail(e, ENGINE_EFORMAT, "Spectra file was prepared for a different latency");
+        }
+        if ( e->opts.samplerate && e->opts.samplerate != samplerate ) {
+            pcfilter_free(f);
+            return fail(e, ENGINE_EFORMAT, "Spectra file was prepared at a different sample rate");
+        }
+
+        setfilter(e, f, samplerate, hash);
+        return ENGINE_OK;
+    }
+
+    // the whole impulse response is needed, but only as spectra
+    soundfile *ir = readsoundfile(path);
+    stats_end(&clock, STAT_IRREAD);
+    if ( ir == NULL )
+        return fail(e, ENGINE_EIO, "Couldn't open sound file for reading");
+    if ( ir->length > INT_MAX ) {
+        soundfile_free(ir);
+        return fail(e, ENGINE_EFORMAT, "Impulse response is too long");
+    }
+
+    int err = engine_prepare(e, ir->data, ir->length, ir->channels, ir->samplerate);
+    soundfile_free(ir);
+
+    return err;
+}
+
+int engine_save(engine *e, const char *path) {
+    if ( e->filter == NULL )
+        return fail(e, ENGINE_ESTATE, "Saving an engine with no impulse response");
+    if ( e->filter->taps )
+        return fail(e, ENGINE_EARG, "A direct filter has no spectra to save");
+
+    if ( spectrafile_write(path, e->filter, e->samplerate, e->hash) )
+        return fail(e, ENGINE_EIO, "Couldn't write spectra file");
+
+    return ENGINE_OK;
+}
+
+int engine_start(engine *e, int inchannels) {
+    if ( e->filter == NULL )
+        return fail(e, ENGINE_ESTATE, "Starting an engine with no impulse response");
+    if ( e->pc )
+        return fail(e, ENGINE_ESTATE, "Starting an engine that has already started");
+    if ( inchannels < 1 )
+        return fail(e, ENGINE_EARG, "No input channels");
+    if ( partconv_outchannels(inchannels, e->filter->channels) == 0 )
+        return fail(e, ENGINE_ECHANNELS, NULL);
+
+    if ( (e->pc = partconv_new(e->filter, inchannels, e->workers)) == NULL )
+        return fail(e, ENGINE_ENOMEM, "Couldn't allocate the convolution state");
+
+    if ( (e->silence = calloc((size_t) e->filter->latency * inchannels, sizeof(float))) == NULL ) {
+        partconv_free(e->pc);
+        e->pc = NULL;
+        return fail(e, ENGINE_ENOMEM, "Couldn't allocate the convolution state");
+    }
+
+    e->tail = 0;
+
+    return ENGINE_OK;
+}
+
+int engine_process(engine *e, const float *in, float *out, int blocks) {
+    if ( e->pc == NULL )
+        return fail(e, ENGINE_ESTATE, "Processing on an engine that hasn't started");
+    if ( blocks < 0 )
+        return fail(e, ENGINE_EARG, "Negative block count");
+
+    if ( blocks ) {
+        partconv_process_batch(e->pc, in, out, blocks);
+        e->tail = e->filter->length - 1;
+    }
+
+    return ENGINE_OK;
+}
+
+int engine_flush(engine *e, float *out, int *frames) {
+    if ( e->pc == NULL )
+        return fail(e, ENGINE_ESTATE, "Flushing an engine that hasn't started");
+
+    int blocksize = e->filter->latency;
+
+    partconv_process(e->pc, e->silence, out);
+
+    *frames = e->tail < blocksize ? e->tail : blocksize;
+    e->tail -= *frames;
+
+    return ENGINE_OK;
+}
+
+int engine_reset(engine *e) {
+    if ( e->pc == NULL )
+        return fail(e, ENGINE_ESTATE, "Resetting an engine that hasn't started");
+
+    partconv_reset(e->pc);
+    e->tail = 0;
+
+    return ENGINE_OK;
+}
+
+int engine_blocksize(const engine *e) {
+    return e->filter ? e->filter->latency : 0;
+}
+
+int engine_outchannels(const engine *e) {
+    return e->pc ? e->pc->outchannels : 0;
+}
+
+int engine_samplerate(const engine *e) {
+    return e->samplerate;
+}
+
+int engine_irlength(const engine *e) {
+    return e->filter ? e->filter->length : 0;
+}
+
+uint64_t engine_hash(const engine *e) {
+    return e->hash;
+}
+
+const pcfilter * engine_filter(const engine *e) {
+    return e->filter;
+}
+
+const planchoice * engine_plan(const engine *e) {
+    return e->filter && e->plan.blocksize ? &e->plan : NULL;
+}
+
+const trimresult * engine_trim(const engine *e) {
+    return e->filter && e->trim.frames ? &e->trim : NULL;
+}
+
+const char * engine_lasterror(const engine *e) {
+    return e->why;
+}
+
+void engine_free(engine *e) {
+    if ( e == NULL )
+        return;
+
+    partconv_free(e->pc);
+    free(e->silence);
+    if ( e->ownsfilter )
+        pcfilter_free(e->filter);
+    if ( e->workers )
+        pool_free(e->workers);
+    free(e);
+}
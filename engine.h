@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+#ifndef __ENGINE_H__
+#define __ENGINE_H__
+
+#include <stdint.h>
+
+#include "partconv.h"
+#include "planner.h"
+#include "trim.h"
+
+// a convolution engine for embedding: it takes caller-owned interleaved
+// float blocks and hands back errors instead of exiting. the life of one is
+//
+//     engine_new -> engine_prepare(_file) -> engine_start
+//         -> engine_process ... -> engine_flush ... -> engine_free
+//
+// everything is allocated by engine_start, so engine_process and
+// engine_flush never touch the allocator and can run on a realtime thread.
+// fft planning effort and wisdom are process-wide, see fft_init.
+typedef struct engine engine;
+
+#define ENGINE_OK         0
+#define ENGINE_ENOMEM    -1 // out of memory, or threads
+#define ENGINE_EIO       -2 // a file couldn't be opened or written
+#define ENGINE_EFORMAT   -3 // a file isn't a usable sound or spectra file
+#define ENGINE_ECHANNELS -4 // input and impulse channel counts can't be paired
+#define ENGINE_ESTATE    -5 // called out of the order above
+#define ENGINE_EARG      -6 // a bad argument
+
+typedef struct {
+    int latency; // 0 for offline use, otherwise the smallest partition size in samples
+    int threads; // threads engine_process spreads its work over, 1 or less for none
+
+    // what the partition size is planned for, see planner.h. 0 if unknown.
+    int64_t inlength;
+    int inchannels;
+    size_t memcap;
+
+    int direct;  // 1 to always convolve in the time domain, -1 never, 0 to leave it to the planner
+
+    // an impulse response at another rate is resampled to this one by
+    // engine_prepare. 0 to take it at its own.
+    int samplerate;
+
+    // engine_prepare cuts the impulse response where its decay falls this
+    // many dB, or at TRIM_NOISEFLOOR where it meets the noise. 0 not at all.
+    float trimdb;
+
+    // how engine_prepare stores the spectra, one of the PC_ formats in
+    // partconv.h. a spectra file keeps the one it was prepared at.
+    int precision;
+
+    // how hard the planner looks, see planinput. FFT_ESTIMATE, the
+    // default, always partitions the same impulse response the same way.
+    int planning;
+
+    // partitions engine_prepare takes in place of planning them, from a
+    // planner_choose on this impulse response and these options. only used
+    // when the impulse isn't resampled or trimmed. NULL to plan.
+    const planchoice *plan;
+} engineopts;
+
+const char * engine_strerror(int err);
+
+// opts may be NULL for the defaults, offline and single threaded
+int engine_new(engine **e, const engineopts *opts);
+
+// a new single threaded engine sharing src's prepared impulse response,
+// for running many streams against one impulse. src must outlive it.
+int engine_clone(engine **e, engine *src);
+
+// partitions and transforms an interleaved impulse response of the given
+// number of frames. the samples are not referenced afterwards. resampling
+// scales the impulse by the ratio of the rates, so its gain at any
+// frequency both rates carry stays the same.
+int engine_prepare(engine *e, const float *ir, int frames, int channels, int samplerate);
+
+// the same from a sound file, or from a spectra file written by engine_save
+int engine_prepare_file(engine *e, const char *path);
+
+// writes the prepared impulse response as a spectra file. a direct filter
+// has no spectra to write.
+int engine_save(engine *e, const char *path);
+
+// sets up for a stream of inchannels. afterwards every engine_process call
+// takes blocks*engine_blocksize input frames of inchannels and produces as
+// many output frames of engine_outchannels.
+int engine_start(engine *e, int inchannels);
+
+int engine_process(engine *e, const float *in, float *out, int blocks);
+
+// after the input has ended, one block of the remaining tail into out.
+// frames is set to how much of it is still part of the convolution, and
+// to 0 once there is none left.
+int engine_flush(engine *e, float *out, int *frames);
+
+// forgets the stream so far, so the next engine_process starts from silence
+int engine_reset(engine *e);
+
+int engine_blocksize(const engine *e);
+int engine_outchannels(const engine *e);
+int engine_samplerate(const engine *e);
+int engine_irlength(const engine *e);
+uint64_t engine_hash(const engine *e);
+const pcfilter * engine_filter(const engine *e);
+
+// how engine_prepare chose the partitions, or NULL if they came from a spectra file
+const planchoice * engine_plan(const engine *e);
+
+// where engine_prepare trimmed the impulse response, or NULL if it wasn't asked to
+const trimresult * engine_trim(const engine *e);
+
+// the details of the last failure, or NULL
+const char * engine_lasterror(const engine *e);
+
+void engine_free(engine *e);
+
+#endif
@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef USE_FFTW3
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fftw3.h>
+#else
+#include "kissfft/kiss_fftr.h"
+#endif
+
+#ifdef USE_KISSFFT_SIMD
+#include "fftsimd.h"
+#include "kernels.h"
+#endif
+
+#include "fft.h"
+
+static int planeffort = FFT_ESTIMATE;
+
+struct fftplan {
+    int len;
+#ifdef USE_FFTW3
+    fftwf_plan fw, bw;
+#else
+    kiss_fftr_cfg fw, bw;
+#endif
+#ifdef USE_KISSFFT_SIMD
+    fftsimdplan *simd; // replaces fw and bw when the length allows it
+#endif
+};
+
+#ifdef USE_FFTW3
+#define WISDOM_DIR "convolute"
+#define WISDOM_FILE "fftw3f.wisdom"
+
+static unsigned planflags = FFTW_ESTIMATE;
+
+// the fftw planner isn't thread safe, execution is
+static pthread_mutex_t planlock = PTHREAD_MUTEX_INITIALIZER;
+
+static char *wisdompath = NULL;
+static char *knownwisdom = NULL; // what the wisdom file held when it was loaded
+
+// $XDG_CACHE_HOME/convolute/fftw3f.wisdom, or under ~/.cache without it.
+// directories are created as needed. returns NULL if there's nowhere to go.
+static char * findwisdom(void) {
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char *path;
+
+    if ( base == NULL || base[0] != '/' ) {
+        if ( home == NULL || home[0] == '\0' )
+            return NULL;
+        if ( (path = malloc(strlen(home) + strlen("/.cache/" WISDOM_DIR "/" WISDOM_FILE) + 1)) == NULL )
+            return NULL;
+        sprintf(path, "%s/.cache", home);
+    } else {
+        if ( (path = malloc(strlen(base) + strlen("/" WISDOM_DIR "/" WISDOM_FILE) + 1)) == NULL )
+            return NULL;
+        strcpy(path, base);
+    }
+
+    mkdir(path, 0700);
+    strcat(path, "/" WISDOM_DIR);
+    mkdir(path, 0700);
+    strcat(path, "/" WISDOM_FILE);
+
+    return path;
+}
+
+// a whole-file fcntl lock, released when the descriptor is closed
+static int lockwisdom(int fd, short type) {
+    struct flock l;
+    memset(&l, 0, sizeof(l));
+    l.l_type = type;
+    l.l_whence = SEEK_SET;
+    while ( fcntl(fd, F_SETLKW, &l) == -1 ) {
+        if ( errno != EINTR )
+            return -1;
+    }
+    return 0;
+}
+
+// read and written through the descriptor alone. closing any other
+// descriptor for the file, even a dup, would drop the fcntl lock.
+static void importwisdom(int fd) {
+    struct stat st;
+    char *text;
+
+    if ( fstat(fd, &st) || st.st_size == 0 )
+        return;
+    if ( (text = malloc(st.st_size + 1)) == NULL )
+        return;
+
+    ssize_t got = pread(fd, text, st.st_size, 0);
+    if ( got == st.st_size ) {
+        text[got] = '\0';
+        fftwf_import_wisdom_from_string(text);
+    }
+
+    free(text);
+}
+
+static void exportwisdom(int fd, const char *wisdom) {
+    size_t len = strlen(wisdom), done = 0;
+
+    if ( ftruncate(fd, 0) )
+        return;
+    while ( done < len ) {
+        ssize_t n = pwrite(fd, wisdom + done, len - done, done);
+        if ( n <= 0 )
+            return;
+        done += n;
+    }
+}
+#endif
+
+void fft_init(int effort) {
+    planeffort = effort;
+
+#ifdef USE_FFTW3
+    planflags = effort == FFT_PATIENT ? FFTW_PATIENT : effort == FFT_MEASURE ? FFTW_MEASURE : FFTW_ESTIMATE;
+
+    // estimated plans are cheap enough to not be worth remembering
+    if ( effort == FFT_ESTIMATE || (wisdompath = findwisdom()) == NULL )
+        return;
+
+    int fd = open(wisdompath, O_RDONLY);
+    if ( fd != -1 ) {
+        if ( lockwisdom(fd, F_RDLCK) == 0 )
+            importwisdom(fd);
+        close(fd);
+    }
+
+    knownwisdom = fftwf_export_wisdom_to_string();
+#endif
+}
+
+int fft_effort(void) {
+    return planeffort;
+}
+
+void fft_finish(void) {
+#ifdef USE_FFTW3
+    // jobs running side by side can all finish, only the first one saves
+    pthread_mutex_lock(&planlock);
+    if ( wisdompath == NULL ) {
+        pthread_mutex_unlock(&planlock);
+        return;
+    }
+
+    char *wisdom = fftwf_export_wisdom_to_string();
+
+    // only rewrite the file if planning taught us something new. whatever
+    // other jobs saved in the meantime is merged in under the lock first.
+    if ( wisdom && (knownwisdom == NULL || strcmp(wisdom, knownwisdom)) ) {
+        int fd = open(wisdompath, O_RDWR | O_CREAT, 0644);
+        if ( fd != -1 ) {
+            if ( lockwisdom(fd, F_WRLCK) == 0 ) {
+                importwisdom(fd);
+
+                char *merged = fftwf_export_wisdom_to_string();
+                if ( merged )
+                    exportwisdom(fd, merged);
+                free(merged);
+            }
+            close(fd);
+        }
+    }
+
+    free(wisdom);
+    free(knownwisdom);
+    free(wisdompath);
+    knownwisdom = NULL;
+    wisdompath = NULL;
+    pthread_mutex_unlock(&planlock);
+#endif
+}
+
+fftplan * fft_plan(int len) {
+    fftplan *p;
+
+    if ( (p = calloc(1, sizeof(*p))) == NULL )
+        return NULL;
+
+    p->len = len;
+
+#ifdef USE_FFTW3
+    // the plans are only ever used through the new-array execute functions,
+    // so these buffers just need the right size and alignment
+    float *in = fftwf_malloc(sizeof(float) * len);
+    fftwf_complex *out = fftwf_malloc(sizeof(fftwf_complex) * (len/2+1));
+
+    if ( in && out ) {
+        pthread_mutex_lock(&planlock);
+        p->fw = fftwf_plan_dft_r2c_1d(len, in, out, planflags);
+        p->bw = fftwf_plan_dft_c2r_1d(len, out, in, planflags);
+        pthread_mutex_unlock(&planlock);
+    }
+
+    fftwf_free(in);
+    fftwf_free(out);
+#else
+#ifdef USE_KISSFFT_SIMD
+    // CONVOLUTE_SIMD=scalar is honored here too, so the scalar build can
+    // be compared against without recompiling
+    if ( len % 8 == 0 && strcmp(kernels_name(), "scalar") != 0 ) {
+        if ( (p->simd = fftsimd_plan(len)) == NULL ) {
+            free(p);
+            return NULL;
+        }
+        return p;
+    }
+#endif
+    p->fw = kiss_fftr_alloc(len, 0, NULL, NULL);
+    p->bw = kiss_fftr_alloc(len, 1, NULL, NULL);
+#endif
+
+    if ( p->fw == NULL || p->bw == NULL ) {
+        fft_plan_free(p);
+        return NULL;
+    }
+
+    return p;
+}
+
+void fft_plan_free(fftplan *p) {
+    if ( p == NULL )
+        return;
+#ifdef USE_FFTW3
+    pthread_mutex_lock(&planlock);
+    if ( p->fw )
+        fftwf_destroy_plan(p->fw);
+    if ( p->bw )
+        fftwf_destroy_plan(p->bw);
+    pthread_mutex_unlock(&planlock);
+#else
+#ifdef USE_KISSFFT_SIMD
+    if ( p->simd ) {
+        fftsimd_plan_free(p->simd);
+        free(p);
+        return;
+    }
+#endif
+    kiss_fftr_free(p->fw);
+    kiss_fftr_free(p->bw);
+#endif
+    free(p);
+}
+
+void fft_forward(fftplan *p, float *in, fftcpx *out) {
+#ifdef USE_FFTW3
+    fftwf_execute_dft_r2c(p->fw, in, (fftwf_complex*) out);
+#else
+#ifdef USE_KISSFFT_SIMD
+    if ( p->simd ) {
+        fftsimd_forward(p->simd, in, out);
+        return;
+    }
+#endif
+    kiss_fftr(p->fw, in, (kiss_fft_cpx*) out);
+#endif
+}
+
+void fft_inverse(fftplan *p, fftcpx *in, float *out) {
+#ifdef USE_FFTW3
+    fftwf_execute_dft_c2r(p->bw, (fftwf_complex*) in, out);
+#else
+#ifdef USE_KISSFFT_SIMD
+    if ( p->simd ) {
+        fftsimd_inverse(p->simd, in, out);
+        return;
+    }
+#endif
+    kiss_fftri(p->bw, (kiss_fft_cpx*) in, out);
+#endif
+}
+
+const char * fft_backend(void) {
+#if defined(USE_FFTW3)
+    return "fftw3";
+#elif defined(USE_KISSFFT_SIMD)
+    return "kissfft-simd";
+#else
+    return "kissfft";
+#endif
+}
+
+void * fft_malloc(size_t bytes) {
+#ifdef USE_FFTW3
+    return fftwf_malloc(bytes);
+#else
+    return KISS_FFT_MALLOC(bytes);
+#endif
+}
+
+void fft_free(void *ptr) {
+#ifdef USE_FFTW3
+    fftwf_free(ptr);
+#else
+    KISS_FFT_FREE(ptr);
+#endif
+}
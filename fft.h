@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef __FFT_H__
+#define __FFT_H__
+
+#include <stddef.h>
+
+// a single complex bin. this has the same layout as both kiss_fft_cpx
+// (with kiss_fft_scalar=float) and fftwf_complex, so either backend can
+// write into it directly.
+typedef struct {
+    float r, i;
+} fftcpx;
+
+// a real-to-complex/complex-to-real transform pair of a fixed length.
+// forward transforms produce len/2+1 bins, inverse transforms are unnormalized.
+typedef struct fftplan fftplan;
+
+// how hard fft_plan works at finding a fast transform. only fftw does more
+// than estimate, and what it measures is kept between runs in a wisdom file
+// under $XDG_CACHE_HOME, locked so concurrent jobs can share it.
+#define FFT_ESTIMATE 0
+#define FFT_MEASURE  1
+#define FFT_PATIENT  2
+
+// sets the planning effort and loads the wisdom file
+void fft_init(int effort);
+
+// the effort fft_init was given, FFT_ESTIMATE before it's called
+int fft_effort(void);
+
+// saves the wisdom file if any plans since fft_init added to it. only the
+// first call after fft_init does anything, from whichever thread.
+void fft_finish(void);
+
+// NULL if out of memory or the library can't plan it
+fftplan * fft_plan(int len);
+void fft_plan_free(fftplan *p);
+
+// in has len samples, out has len/2+1 bins
+void fft_forward(fftplan *p, float *in, fftcpx *out);
+
+// in has len/2+1 bins and is destroyed, out has len samples
+void fft_inverse(fftplan *p, fftcpx *in, float *out);
+
+// spectra stored back to back are padded out to this many bins, so every
+// one of them keeps the alignment fft_malloc gave the first
+#define FFT_BINALIGN 8
+
+static inline int fft_binstride(int len) {
+    return (len/2 + FFT_BINALIGN) & ~(FFT_BINALIGN-1);
+}
+
+// names the transform library built in. the bins are the same layout and
+// scale from any of them.
+const char * fft_backend(void);
+
+// all buffers handed to fft_forward/fft_inverse must come from here
+void * fft_malloc(size_t bytes);
+void fft_free(void *ptr);
+
+#endif
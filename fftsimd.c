@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+// compiled against the 4-wide kissfft build, whose symbols the Makefile
+// renames so it can be linked next to the scalar one
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "kissfft/kiss_fftr.h"
+
+#include "fftsimd.h"
+
+// sample 4m+j of a transform's input sits in lane j of vector m, which is
+// just the input's own memory layout. the lanes are transformed together,
+// then bin k of the whole transform is put together from bin k mod len/4 of
+// every lane, twisted by e^(-2 pi i j k / len).
+struct fftsimdplan {
+    int len;
+    kiss_fftr_cfg fw, bw;    // real transforms of len/4 on every lane
+    kiss_fft_cpx *lanes;     // len/8+1 bins of each lane
+    kiss_fft_cpx *twiddles;  // len/8+1 twists, one per lane
+    kiss_fft_scalar *time;   // len/4 vectors, for input or output that isn't 16 byte aligned
+};
+
+fftsimdplan * fftsimd_plan(int len) {
+    fftsimdplan *p;
+    int lanebins = len/8 + 1;
+
+    if ( len % 8 || (p = calloc(1, sizeof(*p))) == NULL )
+        return NULL;
+
+    p->len = len;
+    p->fw = kiss_fftr_alloc(len/4, 0, NULL, NULL);
+    p->bw = kiss_fftr_alloc(len/4, 1, NULL, NULL);
+    p->lanes = KISS_FFT_MALLOC(sizeof(kiss_fft_cpx) * lanebins);
+    p->twiddles = KISS_FFT_MALLOC(sizeof(kiss_fft_cpx) * lanebins);
+    p->time = KISS_FFT_MALLOC(sizeof(kiss_fft_scalar) * (len/4));
+
+    if ( p->fw == NULL || p->bw == NULL || p->lanes == NULL || p->twiddles == NULL || p->time == NULL ) {
+        fftsimd_plan_free(p);
+        return NULL;
+    }
+
+    for (int k = 0; k < lanebins; k++) {
+        float tr[4], ti[4];
+        for (int j = 0; j < 4; j++) {
+            double phase = -2 * 3.14159265358979323846 * j * k / len;
+            tr[j] = cos(phase);
+            ti[j] = sin(phase);
+        }
+        for (int j = 0; j < 4; j++) {
+            p->twiddles[k].r[j] = tr[j];
+            p->twiddles[k].i[j] = ti[j];
+        }
+    }
+
+    return p;
+}
+
+void fftsimd_plan_free(fftsimdplan *p) {
+    KISS_FFT_FREE(p->fw);
+    KISS_FFT_FREE(p->bw);
+    KISS_FFT_FREE(p->lanes);
+    KISS_FFT_FREE(p->twiddles);
+    KISS_FFT_FREE(p->time);
+    free(p);
+}
+
+static inline kiss_fft_cpx cmul(kiss_fft_cpx a, kiss_fft_cpx b) {
+    kiss_fft_cpx m;
+    m.r = a.r*b.r - a.i*b.i;
+    m.i = a.r*b.i + a.i*b.r;
+    return m;
+}
+
+static inline int aligned(void *ptr) {
+    return ((uintptr_t) ptr & 15) == 0;
+}
+
+static inline void transpose(kiss_fft_scalar *m) {
+    kiss_fft_scalar t[4];
+    for (int j = 0; j < 4; j++)
+        t[j] = (kiss_fft_scalar){ m[0][j], m[1][j], m[2][j], m[3][j] };
+    for (int j = 0; j < 4; j++)
+        m[j] = t[j];
+}
+
+// four consecutive bins from split real and imaginary parts, in order or backwards
+static inline void storebins(fftcpx *out, kiss_fft_scalar re, kiss_fft_scalar im, int backwards) {
+    for (int n = 0; n < 4; n++) {
+        out[backwards ? 3-n : n].r = re[n];
+        out[backwards ? 3-n : n].i = im[n];
+    }
+}
+
+static inline void loadbins(fftcpx *in, kiss_fft_scalar *re, kiss_fft_scalar *im, int backwards) {
+    for (int n = 0; n < 4; n++) {
+        (*re)[n] = in[backwards ? 3-n : n].r;
+        (*im)[n] = in[backwards ? 3-n : n].i;
+    }
+}
+
+// a 4 point transform across the lanes of bin k gives bins k + q*len/4. the
+// last two are past len/2, so they land mirrored and conjugated.
+static void forwardbin(fftsimdplan *p, fftcpx *out, int k) {
+    int quarter = p->len/4;
+    kiss_fft_cpx t = cmul(p->lanes[k], p->twiddles[k]);
+
+    float ar = t.r[0] + t.r[2], ai = t.i[0] + t.i[2];
+    float br = t.r[0] - t.r[2], bi = t.i[0] - t.i[2];
+    float cr = t.r[1] + t.r[3], ci = t.i[1] + t.i[3];
+    float dr = t.r[1] - t.r[3], di = t.i[1] - t.i[3];
+
+    out[k].r = ar + cr;
+    out[k].i = ai + ci;
+    out[k+quarter].r = br + di;
+    out[k+quarter].i = bi - dr;
+
+    if ( k == 0 ) {
+        out[2*quarter].r = ar - cr;
+        out[2*quarter].i = ai - ci;
+    } else if ( 2*k < quarter ) {
+        out[2*quarter-k].r = ar - cr;
+        out[2*quarter-k].i = ci - ai;
+        out[quarter-k].r = br - di;
+        out[quarter-k].i = -bi - dr;
+    }
+}
+
+// the same, undone for lane bin k
+static void inversebin(fftsimdplan *p, fftcpx *in, int k) {
+    int quarter = p->len/4;
+    fftcpx x0 = in[k], x1 = in[k+quarter], x2, x3;
+
+    if ( k == 0 ) {
+        x2 = in[2*quarter];
+        x3.r = in[quarter].r;
+        x3.i = -in[quarter].i;
+    } else {
+        x2.r = in[2*quarter-k].r;
+        x2.i = -in[2*quarter-k].i;
+        x3.r = in[quarter-k].r;
+        x3.i = -in[quarter-k].i;
+    }
+
+    float ar = x0.r + x2.r, ai = x0.i + x2.i;
+    float br = x0.r - x2.r, bi = x0.i - x2.i;
+    float cr = x1.r + x3.r, ci = x1.i + x3.i;
+    float dr = x1.r - x3.r, di = x1.i - x3.i;
+
+    kiss_fft_cpx t, tw;
+    t.r = (kiss_fft_scalar){ ar + cr, br - di, ar - cr, br + di };
+    t.i = (kiss_fft_scalar){ ai + ci, bi + dr, ai - ci, bi - dr };
+
+    tw.r = p->twiddles[k].r;
+    tw.i = -p->twiddles[k].i;
+    p->lanes[k] = cmul(t, tw);
+}
+
+void fftsimd_forward(fftsimdplan *p, float *in, fftcpx *out) {
+    int quarter = p->len/4, half = quarter/2, k;
+    kiss_fft_scalar *time = (kiss_fft_scalar*) in;
+
+    if ( !aligned(in) ) {
+        memcpy(p->time, in, sizeof(float) * p->len);
+        time = p->time;
+    }
+
+    kiss_fftr(p->fw, time, p->lanes);
+
+    forwardbin(p, out, 0);
+
+    // four bins at a time, transposed so each vector holds one lane of all four
+    for (k = 1; k + 4 <= half; k += 4) {
+        kiss_fft_scalar r[4], i[4];
+        for (int n = 0; n < 4; n++) {
+            kiss_fft_cpx t = cmul(p->lanes[k+n], p->twiddles[k+n]);
+            r[n] = t.r;
+            i[n] = t.i;
+        }
+        transpose(r);
+        transpose(i);
+
+        kiss_fft_scalar ar = r[0] + r[2], ai = i[0] + i[2];
+        kiss_fft_scalar br = r[0] - r[2], bi = i[0] - i[2];
+        kiss_fft_scalar cr = r[1] + r[3], ci = i[1] + i[3];
+        kiss_fft_scalar dr = r[1] - r[3], di = i[1] - i[3];
+
+        storebins(&out[k], ar + cr, ai + ci, 0);
+        storebins(&out[k+quarter], br + di, bi - dr, 0);
+        storebins(&out[2*quarter-k-3], ar - cr, ci - ai, 1);
+        storebins(&out[quarter-k-3], br - di, -bi - dr, 1);
+    }
+
+    for (; k <= half; k++)
+        forwardbin(p, out, k);
+}
+
+void fftsimd_inverse(fftsimdplan *p, fftcpx *in, float *out) {
+    int quarter = p->len/4, half = quarter/2, k;
+    kiss_fft_scalar *time = aligned(out) ? (kiss_fft_scalar*) out : p->time;
+
+    inversebin(p, in, 0);
+
+    for (k = 1; k + 4 <= half; k += 4) {
+        kiss_fft_scalar x0r, x0i, x1r, x1i, x2r, x2i, x3r, x3i;
+        loadbins(&in[k], &x0r, &x0i, 0);
+        loadbins(&in[k+quarter], &x1r, &x1i, 0);
+        loadbins(&in[2*quarter-k-3], &x2r, &x2i, 1);
+        loadbins(&in[quarter-k-3], &x3r, &x3i, 1);
+        x2i = -x2i;
+        x3i = -x3i;
+
+        kiss_fft_scalar ar = x0r + x2r, ai = x0i + x2i;
+        kiss_fft_scalar br = x0r - x2r, bi = x0i - x2i;
+        kiss_fft_scalar cr = x1r + x3r, ci = x1i + x3i;
+        kiss_fft_scalar dr = x1r - x3r, di = x1i - x3i;
+
+        kiss_fft_scalar r[4] = { ar + cr, br - di, ar - cr, br + di };
+        kiss_fft_scalar i[4] = { ai + ci, bi + dr, ai - ci, bi - dr };
+        transpose(r);
+        transpose(i);
+
+        for (int n = 0; n < 4; n++) {
+            kiss_fft_cpx t, tw;
+            t.r = r[n];
+            t.i = i[n];
+            tw.r = p->twiddles[k+n].r;
+            tw.i = -p->twiddles[k+n].i;
+            p->lanes[k+n] = cmul(t, tw);
+        }
+    }
+
+    for (; k <= half; k++)
+        inversebin(p, in, k);
+
+    kiss_fftri(p->bw, p->lanes, time);
+
+    if ( time != (kiss_fft_scalar*) out )
+        memcpy(out, time, sizeof(float) * p->len);
+}
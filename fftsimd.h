@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef __FFTSIMD_H__
+#define __FFTSIMD_H__
+
+#include "fft.h"
+
+// a real transform of len samples computed as four interleaved transforms of
+// len/4 samples, one per vector lane of the 4-wide kissfft build, and then
+// recombined. len must be a multiple of 8. same conventions as fft.h.
+typedef struct fftsimdplan fftsimdplan;
+
+// NULL if out of memory
+fftsimdplan * fftsimd_plan(int len);
+void fftsimd_plan_free(fftsimdplan *p);
+
+void fftsimd_forward(fftsimdplan *p, float *in, fftcpx *out);
+void fftsimd_inverse(fftsimdplan *p, fftcpx *in, float *out);
+
+#endif
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+#ifndef __HALF_H__
+#define __HALF_H__
+
+#include <stdint.h>
+
+// conversions between floats and the two 16 bit formats impulse spectra can
+// be stored in. float16 keeps 11 bits of mantissa over a small exponent
+// range, bfloat16 keeps a float's exponent range and 8 bits of mantissa.
+// both round to nearest even. they work on the bits, apart from one float
+// add that rounds float16 subnormals and one multiply that widens them back.
+// neither makes a float denormal, and one going in is far under the
+// smallest float16 and rounds to zero anyway, so flushing denormals to
+// zero doesn't change what they return.
+
+typedef union {
+    float f;
+    uint32_t u;
+} halfbits;
+
+static inline uint16_t half_fromfloat(float f) {
+    halfbits v = { f };
+    uint32_t sign = (v.u >> 16) & 0x8000;
+    uint32_t a = v.u & 0x7fffffff;
+
+    // nan stays nan, and anything from 65520 up rounds to infinity
+    if ( a >= 0x47800000 )
+        return sign | (a > 0x7f800000 ? 0x7e00 : 0x7c00);
+
+    // under 2^-14 is subnormal, adding a half lines the mantissa up in the
+    // low bits and lets the add do the rounding
+    if ( a < 0x38800000 ) {
+        v.u = a;
+        v.f += 0.5f;
+        return sign | (v.u - 0x3f000000);
+    }
+
+    // rebias the exponent and round off the 13 bits that don't fit
+    a += 0xc8000fff + ((a >> 13) & 1);
+    return sign | (a >> 13);
+}
+
+static inline float half_tofloat(uint16_t h) {
+    uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    halfbits v;
+
+    if ( exp == 0 ) {
+        v.f = mant * 0x1p-24f;
+        v.u |= sign;
+    } else if ( exp == 31 ) {
+        v.u = sign | 0x7f800000 | mant << 13;
+    } else {
+        v.u = sign | (exp + 112) << 23 | mant << 13;
+    }
+
+    return v.f;
+}
+
+static inline uint16_t bfloat_fromfloat(float f) {
+    halfbits v = { f };
+
+    if ( (v.u & 0x7fffffff) > 0x7f800000 )
+        return (v.u >> 16) | 0x40;
+
+    return (v.u + 0x7fff + ((v.u >> 16) & 1)) >> 16;
+}
+
+static inline float bfloat_tofloat(uint16_t b) {
+    halfbits v;
+    v.u = (uint32_t) b << 16;
+    return v.f;
+}
+
+#endif
@@ -0,0 +1,717 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNELS_X86
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define KERNELS_NEON
+#endif
+
+#include "half.h"
+#include "kernels.h"
+
+static void cmac_scalar(fftcpx *acc, const fftcpx *x, const fftcpx *h, int n) {
+    for (int i = 0; i < n; i++) {
+        acc[i].r += x[i].r*h[i].r - x[i].i*h[i].i;
+        acc[i].i += x[i].r*h[i].i + x[i].i*h[i].r;
+    }
+}
+
+static void cmachalf_scalar(fftcpx *acc, const fftcpx *x, const uint16_t *h, float scale, int n) {
+    for (int i = 0; i < n; i++) {
+        float hr = half_tofloat(h[i*2]) * scale, hi = half_tofloat(h[i*2+1]) * scale;
+        acc[i].r += x[i].r*hr - x[i].i*hi;
+        acc[i].i += x[i].r*hi + x[i].i*hr;
+    }
+}
+
+static void cmacbfloat_scalar(fftcpx *acc, const fftcpx *x, const uint16_t *h, float scale, int n) {
+    for (int i = 0; i < n; i++) {
+        float hr = bfloat_tofloat(h[i*2]) * scale, hi = bfloat_tofloat(h[i*2+1]) * scale;
+        acc[i].r += x[i].r*hr - x[i].i*hi;
+        acc[i].i += x[i].r*hi + x[i].i*hr;
+    }
+}
+
+static void addscaled_scalar(float *dst, const float *src, float scale, int n) {
+    for (int i = 0; i < n; i++)
+        dst[i] += src[i] * scale;
+}
+
+static int clippeak_scalar(float *data, int n, float gain, float *peak) {
+    int clipped = 0;
+    float max = *peak;
+
+    for (int i = 0; i < n; i++) {
+        float v = data[i] * gain;
+        if ( fabsf(v) > max )
+            max = fabsf(v);
+        if ( fabsf(v) > 1 ) {
+            clipped++;
+            v = v > 0 ? 1 : -1;
+        }
+        data[i] = v;
+    }
+
+    *peak = max;
+    return clipped;
+}
+
+static void interleave_scalar(float *out, const float *const *in, int channels, int n) {
+    if ( channels == 1 ) {
+        memcpy(out, in[0], sizeof(float) * n);
+        return;
+    }
+
+    for (int i = 0; i < n; i++)
+        for (int c = 0; c < channels; c++)
+            out[i*channels + c] = in[c][i];
+}
+
+static void fir_scalar(float *out, const float *x, const float *h, int taps, int n) {
+    for (int i = 0; i < n; i++) {
+        float sum = 0;
+        for (int k = 0; k < taps; k++)
+            sum += x[i+k] * h[k];
+        out[i] = sum;
+    }
+}
+
+static float dot_scalar(const float *x, const float *h, int n) {
+    float sum = 0;
+    for (int i = 0; i < n; i++)
+        sum += x[i] * h[i];
+    return sum;
+}
+
+#ifdef KERNELS_X86
+
+// complex bins are interleaved re,im pairs. each vector multiply works on the
+// real parts of h against x, then adds the imaginary parts of h against x with
+// re/im swapped, negating the even lanes of the latter.
+
+__attribute__((target("sse2")))
+static inline __m128 cmul_sse2(__m128 xv, __m128 hv) {
+    const __m128 sign = _mm_castsi128_ps(_mm_set_epi32(0, 0x80000000, 0, 0x80000000));
+    __m128 hre = _mm_shuffle_ps(hv, hv, _MM_SHUFFLE(2,2,0,0));
+    __m128 him = _mm_shuffle_ps(hv, hv, _MM_SHUFFLE(3,3,1,1));
+    __m128 xsw = _mm_shuffle_ps(xv, xv, _MM_SHUFFLE(2,3,0,1));
+    return _mm_add_ps(_mm_mul_ps(xv, hre), _mm_xor_ps(_mm_mul_ps(xsw, him), sign));
+}
+
+__attribute__((target("sse2")))
+static void cmac_sse2(fftcpx *acc, const fftcpx *x, const fftcpx *h, int n) {
+    int i = 0;
+
+    for (; i + 2 <= n; i += 2) {
+        __m128 prod = cmul_sse2(_mm_loadu_ps((const float*) &x[i]), _mm_loadu_ps((const float*) &h[i]));
+        _mm_storeu_ps((float*) &acc[i], _mm_add_ps(_mm_loadu_ps((float*) &acc[i]), prod));
+    }
+
+    cmac_scalar(&acc[i], &x[i], &h[i], n-i);
+}
+
+// a bfloat16 is the top half of a float, so interleaving zeros below each
+// one expands it. sse2 has nothing for float16, that takes f16c.
+__attribute__((target("sse2")))
+static void cmacbfloat_sse2(fftcpx *acc, const fftcpx *x, const uint16_t *h, float scale, int n) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128 s = _mm_set1_ps(scale);
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i hv = _mm_loadu_si128((const __m128i*) &h[i*2]);
+        __m128 lo = _mm_mul_ps(_mm_castsi128_ps(_mm_unpacklo_epi16(zero, hv)), s);
+        __m128 hi = _mm_mul_ps(_mm_castsi128_ps(_mm_unpackhi_epi16(zero, hv)), s);
+        __m128 p0 = cmul_sse2(_mm_loadu_ps((const float*) &x[i]), lo);
+        __m128 p1 = cmul_sse2(_mm_loadu_ps((const float*) &x[i+2]), hi);
+        _mm_storeu_ps((float*) &acc[i], _mm_add_ps(_mm_loadu_ps((float*) &acc[i]), p0));
+        _mm_storeu_ps((float*) &acc[i+2], _mm_add_ps(_mm_loadu_ps((float*) &acc[i+2]), p1));
+    }
+
+    cmacbfloat_scalar(&acc[i], &x[i], &h[i*2], scale, n-i);
+}
+
+__attribute__((target("sse2")))
+static void addscaled_sse2(float *dst, const float *src, float scale, int n) {
+    __m128 s = _mm_set1_ps(scale);
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(&dst[i], _mm_add_ps(_mm_loadu_ps(&dst[i]), _mm_mul_ps(_mm_loadu_ps(&src[i]), s)));
+
+    addscaled_scalar(&dst[i], &src[i], scale, n-i);
+}
+
+__attribute__((target("sse2")))
+static int clippeak_sse2(float *data, int n, float gain, float *peak) {
+    const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 one = _mm_set1_ps(1), minusone = _mm_set1_ps(-1);
+    __m128 g = _mm_set1_ps(gain);
+    __m128 max = _mm_set1_ps(*peak);
+    int clipped = 0;
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_mul_ps(_mm_loadu_ps(&data[i]), g);
+        __m128 a = _mm_and_ps(v, absmask);
+        max = _mm_max_ps(max, a);
+        clipped += __builtin_popcount(_mm_movemask_ps(_mm_cmpgt_ps(a, one)));
+        _mm_storeu_ps(&data[i], _mm_min_ps(_mm_max_ps(v, minusone), one));
+    }
+
+    float lanes[4];
+    _mm_storeu_ps(lanes, max);
+    *peak = fmaxf(fmaxf(lanes[0], lanes[1]), fmaxf(lanes[2], lanes[3]));
+
+    return clipped + clippeak_scalar(&data[i], n-i, gain, peak);
+}
+
+// the fir kernels keep four vectors of consecutive outputs in registers and
+// stream the taps past them, each tap broadcast once for all four. every
+// output still sums its taps in order, as the scalar one does.
+
+__attribute__((target("sse2")))
+static void fir_sse2(float *out, const float *x, const float *h, int taps, int n) {
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps(), a2 = _mm_setzero_ps(), a3 = _mm_setzero_ps();
+        for (int k = 0; k < taps; k++) {
+            const float *xk = &x[i+k];
+            __m128 hk = _mm_set1_ps(h[k]);
+            a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(xk), hk));
+            a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(xk+4), hk));
+            a2 = _mm_add_ps(a2, _mm_mul_ps(_mm_loadu_ps(xk+8), hk));
+            a3 = _mm_add_ps(a3, _mm_mul_ps(_mm_loadu_ps(xk+12), hk));
+        }
+        _mm_storeu_ps(&out[i], a0);
+        _mm_storeu_ps(&out[i+4], a1);
+        _mm_storeu_ps(&out[i+8], a2);
+        _mm_storeu_ps(&out[i+12], a3);
+    }
+
+    for (; i + 4 <= n; i += 4) {
+        __m128 a = _mm_setzero_ps();
+        for (int k = 0; k < taps; k++)
+            a = _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(&x[i+k]), _mm_set1_ps(h[k])));
+        _mm_storeu_ps(&out[i], a);
+    }
+
+    fir_scalar(&out[i], &x[i], h, taps, n-i);
+}
+
+// the dot kernels keep several partial sums to hide the add latency and
+// only fold them together at the end
+__attribute__((target("sse2")))
+static float dot_sse2(const float *x, const float *h, int n) {
+    __m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps();
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(&x[i]), _mm_loadu_ps(&h[i])));
+        a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(&x[i+4]), _mm_loadu_ps(&h[i+4])));
+    }
+    for (; i + 4 <= n; i += 4)
+        a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(&x[i]), _mm_loadu_ps(&h[i])));
+
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(a0, a1));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + dot_scalar(&x[i], &h[i], n-i);
+}
+
+// only stereo gets a vector path, anything else is left to the scalar one
+__attribute__((target("sse2")))
+static void interleave_sse2(float *out, const float *const *in, int channels, int n) {
+    int i = 0;
+
+    if ( channels == 2 ) {
+        for (; i + 4 <= n; i += 4) {
+            __m128 l = _mm_loadu_ps(&in[0][i]), r = _mm_loadu_ps(&in[1][i]);
+            _mm_storeu_ps(&out[i*2], _mm_unpacklo_ps(l, r));
+            _mm_storeu_ps(&out[i*2+4], _mm_unpackhi_ps(l, r));
+        }
+        const float *rest[2] = { &in[0][i], &in[1][i] };
+        interleave_scalar(&out[i*2], rest, 2, n-i);
+        return;
+    }
+
+    interleave_scalar(out, in, channels, n);
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 cmul_avx2(__m256 xv, __m256 hv) {
+    __m256 hre = _mm256_moveldup_ps(hv);
+    __m256 him = _mm256_movehdup_ps(hv);
+    __m256 xsw = _mm256_permute_ps(xv, _MM_SHUFFLE(2,3,0,1));
+    return _mm256_fmaddsub_ps(xv, hre, _mm256_mul_ps(xsw, him));
+}
+
+__attribute__((target("avx2,fma")))
+static void cmac_avx2(fftcpx *acc, const fftcpx *x, const fftcpx *h, int n) {
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m256 prod = cmul_avx2(_mm256_loadu_ps((const float*) &x[i]), _mm256_loadu_ps((const float*) &h[i]));
+        _mm256_storeu_ps((float*) &acc[i], _mm256_add_ps(_mm256_loadu_ps((float*) &acc[i]), prod));
+    }
+
+    cmac_sse2(&acc[i], &x[i], &h[i], n-i);
+}
+
+// only picked when the cpu has f16c as well, see kernels_init
+__attribute__((target("avx2,fma,f16c")))
+static void cmachalf_avx2(fftcpx *acc, const fftcpx *x, const uint16_t *h, float scale, int n) {
+    __m256 s = _mm256_set1_ps(scale);
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m256 hv = _mm256_mul_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) &h[i*2])), s);
+        __m256 prod = cmul_avx2(_mm256_loadu_ps((const float*) &x[i]), hv);
+        _mm256_storeu_ps((float*) &acc[i], _mm256_add_ps(_mm256_loadu_ps((float*) &acc[i]), prod));
+    }
+
+    cmachalf_scalar(&acc[i], &x[i], &h[i*2], scale, n-i);
+}
+
+__attribute__((target("avx2,fma")))
+static void cmacbfloat_avx2(fftcpx *acc, const fftcpx *x, const uint16_t *h, float scale, int n) {
+    __m256 s = _mm256_set1_ps(scale);
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) &h[i*2]));
+        __m256 hv = _mm256_mul_ps(_mm256_castsi256_ps(_mm256_slli_epi32(wide, 16)), s);
+        __m256 prod = cmul_avx2(_mm256_loadu_ps((const float*) &x[i]), hv);
+        _mm256_storeu_ps((float*) &acc[i], _mm256_add_ps(_mm256_loadu_ps((float*) &acc[i]), prod));
+    }
+
+    cmacbfloat_sse2(&acc[i], &x[i], &h[i*2], scale, n-i);
+}
+
+__attribute__((target("avx2,fma")))
+static void addscaled_avx2(float *dst, const float *src, float scale, int n) {
+    __m256 s = _mm256_set1_ps(scale);
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(&dst[i], _mm256_fmadd_ps(_mm256_loadu_ps(&src[i]), s, _mm256_loadu_ps(&dst[i])));
+
+    addscaled_scalar(&dst[i], &src[i], scale, n-i);
+}
+
+__attribute__((target("avx2,fma")))
+static int clippeak_avx2(float *data, int n, float gain, float *peak) {
+    const __m256 absmask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    const __m256 one = _mm256_set1_ps(1), minusone = _mm256_set1_ps(-1);
+    __m256 g = _mm256_set1_ps(gain);
+    __m256 max = _mm256_set1_ps(*peak);
+    int clipped = 0;
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_mul_ps(_mm256_loadu_ps(&data[i]), g);
+        __m256 a = _mm256_and_ps(v, absmask);
+        max = _mm256_max_ps(max, a);
+        clipped += __builtin_popcount(_mm256_movemask_ps(_mm256_cmp_ps(a, one, _CMP_GT_OQ)));
+        _mm256_storeu_ps(&data[i], _mm256_min_ps(_mm256_max_ps(v, minusone), one));
+    }
+
+    float lanes[8];
+    _mm256_storeu_ps(lanes, max);
+    for (int l = 0; l < 8; l++)
+        *peak = fmaxf(*peak, lanes[l]);
+
+    return clipped + clippeak_scalar(&data[i], n-i, gain, peak);
+}
+
+__attribute__((target("avx2,fma")))
+static void fir_avx2(float *out, const float *x, const float *h, int taps, int n) {
+    int i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps(), a2 = _mm256_setzero_ps(), a3 = _mm256_setzero_ps();
+        for (int k = 0; k < taps; k++) {
+            const float *xk = &x[i+k];
+            __m256 hk = _mm256_broadcast_ss(&h[k]);
+            a0 = _mm256_fmadd_ps(_mm256_loadu_ps(xk), hk, a0);
+            a1 = _mm256_fmadd_ps(_mm256_loadu_ps(xk+8), hk, a1);
+            a2 = _mm256_fmadd_ps(_mm256_loadu_ps(xk+16), hk, a2);
+            a3 = _mm256_fmadd_ps(_mm256_loadu_ps(xk+24), hk, a3);
+        }
+        _mm256_storeu_ps(&out[i], a0);
+        _mm256_storeu_ps(&out[i+8], a1);
+        _mm256_storeu_ps(&out[i+16], a2);
+        _mm256_storeu_ps(&out[i+24], a3);
+    }
+
+    for (; i + 8 <= n; i += 8) {
+        __m256 a = _mm256_setzero_ps();
+        for (int k = 0; k < taps; k++)
+            a = _mm256_fmadd_ps(_mm256_loadu_ps(&x[i+k]), _mm256_broadcast_ss(&h[k]), a);
+        _mm256_storeu_ps(&out[i], a);
+    }
+
+    fir_sse2(&out[i], &x[i], h, taps, n-i);
+}
+
+__attribute__((target("avx2,fma")))
+static float dot_avx2(const float *x, const float *h, int n) {
+    __m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps();
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        a0 = _mm256_fmadd_ps(_mm256_loadu_ps(&x[i]), _mm256_loadu_ps(&h[i]), a0);
+        a1 = _mm256_fmadd_ps(_mm256_loadu_ps(&x[i+8]), _mm256_loadu_ps(&h[i+8]), a1);
+    }
+    a0 = _mm256_add_ps(a0, a1);
+
+    __m128 a = _mm_add_ps(_mm256_castps256_ps128(a0), _mm256_extractf128_ps(a0, 1));
+    float lanes[4];
+    _mm_storeu_ps(lanes, a);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + dot_sse2(&x[i], &h[i], n-i);
+}
+
+__attribute__((target("avx2,fma")))
+static void interleave_avx2(float *out, const float *const *in, int channels, int n) {
+    int i = 0;
+
+    if ( channels == 2 ) {
+        // unpacking works within 128 bit lanes, so the halves get put back in order after
+        for (; i + 8 <= n; i += 8) {
+            __m256 l = _mm256_loadu_ps(&in[0][i]), r = _mm256_loadu_ps(&in[1][i]);
+            __m256 lo = _mm256_unpacklo_ps(l, r), hi = _mm256_unpackhi_ps(l, r);
+            _mm256_storeu_ps(&out[i*2], _mm256_permute2f128_ps(lo, hi, 0x20));
+            _mm256_storeu_ps(&out[i*2+8], _mm256_permute2f128_ps(lo, hi, 0x31));
+        }
+        const float *rest[2] = { &in[0][i], &in[1][i] };
+        interleave_sse2(&out[i*2], rest, 2, n-i);
+        return;
+    }
+
+    interleave_scalar(out, in, channels, n);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 cmul_avx512(__m512 xv, __m512 hv) {
+    __m512 hre = _mm512_moveldup_ps(hv);
+    __m512 him = _mm512_movehdup_ps(hv);
+    __m512 xsw = _mm512_permute_ps(xv, _MM_SHUFFLE(2,3,0,1));
+    return _mm512_fmaddsub_ps(xv, hre, _mm512_mul_ps(xsw, him));
+}
+
+__attribute__((target("avx512f")))
+static void cmac_avx512(fftcpx *acc, const fftcpx *x, const fftcpx *h, int n) {
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m512 prod = cmul_avx512(_mm512_loadu_ps((const float*) &x[i]), _mm512_loadu_ps((const float*) &h[i]));
+        _mm512_storeu_ps((float*) &acc[i], _mm512_add_ps(_mm512_loadu_ps((float*) &acc[i]), prod));
+    }
+
+    cmac_avx2(&acc[i], &x[i], &h[i], n-i);
+}
+
+// avx512f has its own float16 conversion, and every cpu with it has f16c for the rest
+__attribute__((target("avx512f,avx2,fma,f16c")))
+static void cmachalf_avx512(fftcpx *acc, const fftcpx *x, const uint16_t *h, float scale, int n) {
+    __m512 s = _mm512_set1_ps(scale);
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m512 hv = _mm512_mul_ps(_mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*) &h[i*2])), s);
+        __m512 prod = cmul_avx512(_mm512_loadu_ps((const float*) &x[i]), hv);
+        _mm512_storeu_ps((float*) &acc[i], _mm512_add_ps(_mm512_loadu_ps((float*) &acc[i]), prod));
+    }
+
+    cmachalf_avx2(&acc[i], &x[i], &h[i*2], scale, n-i);
+}
+
+__attribute__((target("avx512f")))
+static void cmacbfloat_avx512(fftcpx *acc, const fftcpx *x, const uint16_t *h, float scale, int n) {
+    __m512 s = _mm512_set1_ps(scale);
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m512i wide = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*) &h[i*2]));
+        __m512 hv = _mm512_mul_ps(_mm512_castsi512_ps(_mm512_slli_epi32(wide, 16)), s);
+        __m512 prod = cmul_avx512(_mm512_loadu_ps((const float*) &x[i]), hv);
+        _mm512_storeu_ps((float*) &acc[i], _mm512_add_ps(_mm512_loadu_ps((float*) &acc[i]), prod));
+    }
+
+    cmacbfloat_avx2(&acc[i], &x[i], &h[i*2], scale, n-i);
+}
+
+__attribute__((target("avx512f")))
+static void addscaled_avx512(float *dst, const float *src, float scale, int n) {
+    __m512 s = _mm512_set1_ps(scale);
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16)
+        _mm512_storeu_ps(&dst[i], _mm512_fmadd_ps(_mm512_loadu_ps(&src[i]), s, _mm512_loadu_ps(&dst[i])));
+
+    addscaled_avx2(&dst[i], &src[i], scale, n-i);
+}
+
+__attribute__((target("avx512f")))
+static int clippeak_avx512(float *data, int n, float gain, float *peak) {
+    const __m512 one = _mm512_set1_ps(1), minusone = _mm512_set1_ps(-1);
+    __m512 g = _mm512_set1_ps(gain);
+    __m512 max = _mm512_set1_ps(*peak);
+    int clipped = 0;
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m512 v = _mm512_mul_ps(_mm512_loadu_ps(&data[i]), g);
+        __m512 a = _mm512_abs_ps(v);
+        max = _mm512_max_ps(max, a);
+        clipped += __builtin_popcount(_mm512_cmp_ps_mask(a, one, _CMP_GT_OQ));
+        _mm512_storeu_ps(&data[i], _mm512_min_ps(_mm512_max_ps(v, minusone), one));
+    }
+
+    *peak = fmaxf(*peak, _mm512_reduce_max_ps(max));
+
+    return clipped + clippeak_avx2(&data[i], n-i, gain, peak);
+}
+
+__attribute__((target("avx512f")))
+static void fir_avx512(float *out, const float *x, const float *h, int taps, int n) {
+    int i = 0;
+
+    for (; i + 64 <= n; i += 64) {
+        __m512 a0 = _mm512_setzero_ps(), a1 = _mm512_setzero_ps(), a2 = _mm512_setzero_ps(), a3 = _mm512_setzero_ps();
+        for (int k = 0; k < taps; k++) {
+            const float *xk = &x[i+k];
+            __m512 hk = _mm512_set1_ps(h[k]);
+            a0 = _mm512_fmadd_ps(_mm512_loadu_ps(xk), hk, a0);
+            a1 = _mm512_fmadd_ps(_mm512_loadu_ps(xk+16), hk, a1);
+            a2 = _mm512_fmadd_ps(_mm512_loadu_ps(xk+32), hk, a2);
+            a3 = _mm512_fmadd_ps(_mm512_loadu_ps(xk+48), hk, a3);
+        }
+        _mm512_storeu_ps(&out[i], a0);
+        _mm512_storeu_ps(&out[i+16], a1);
+        _mm512_storeu_ps(&out[i+32], a2);
+        _mm512_storeu_ps(&out[i+48], a3);
+    }
+
+    fir_avx2(&out[i], &x[i], h, taps, n-i);
+}
+
+__attribute__((target("avx512f")))
+static float dot_avx512(const float *x, const float *h, int n) {
+    __m512 a0 = _mm512_setzero_ps(), a1 = _mm512_setzero_ps();
+    int i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        a0 = _mm512_fmadd_ps(_mm512_loadu_ps(&x[i]), _mm512_loadu_ps(&h[i]), a0);
+        a1 = _mm512_fmadd_ps(_mm512_loadu_ps(&x[i+16]), _mm512_loadu_ps(&h[i+16]), a1);
+    }
+
+    return _mm512_reduce_add_ps(_mm512_add_ps(a0, a1)) + dot_avx2(&x[i], &h[i], n-i);
+}
+
+#endif
+
+#ifdef KERNELS_NEON
+
+// advanced simd is always there on aarch64, so no cpu check is needed
+
+static void cmac_neon(fftcpx *acc, const fftcpx *x, const fftcpx *h, int n) {
+    int i = 0;
+
+    // vld2 splits four bins into a vector of real parts and one of imaginary
+    for (; i + 4 <= n; i += 4) {
+        float32x4x2_t xv = vld2q_f32((const float*) &x[i]);
+        float32x4x2_t hv = vld2q_f32((const float*) &h[i]);
+        float32x4x2_t av = vld2q_f32((const float*) &acc[i]);
+        av.val[0] = vfmaq_f32(av.val[0], xv.val[0], hv.val[0]);
+        av.val[0] = vfmsq_f32(av.val[0], xv.val[1], hv.val[1]);
+        av.val[1] = vfmaq_f32(av.val[1], xv.val[0], hv.val[1]);
+        av.val[1] = vfmaq_f32(av.val[1], xv.val[1], hv.val[0]);
+        vst2q_f32((float*) &acc[i], av);
+    }
+
+    cmac_scalar(&acc[i], &x[i], &h[i], n-i);
+}
+
+// vld2 splits the stored pairs the same way, and each half widens to floats
+static void cmachalf_neon(fftcpx *acc, const fftcpx *x, const uint16_t *h, float scale, int n) {
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        uint16x4x2_t hh = vld2_u16(&h[i*2]);
+        float32x4_t hre = vmulq_n_f32(vcvt_f32_f16(vreinterpret_f16_u16(hh.val[0])), scale);
+        float32x4_t him = vmulq_n_f32(vcvt_f32_f16(vreinterpret_f16_u16(hh.val[1])), scale);
+        float32x4x2_t xv = vld2q_f32((const float*) &x[i]);
+        float32x4x2_t av = vld2q_f32((const float*) &acc[i]);
+        av.val[0] = vfmaq_f32(av.val[0], xv.val[0], hre);
+        av.val[0] = vfmsq_f32(av.val[0], xv.val[1], him);
+        av.val[1] = vfmaq_f32(av.val[1], xv.val[0], him);
+        av.val[1] = vfmaq_f32(av.val[1], xv.val[1], hre);
+        vst2q_f32((float*) &acc[i], av);
+    }
+
+    cmachalf_scalar(&acc[i], &x[i], &h[i*2], scale, n-i);
+}
+
+static void cmacbfloat_neon(fftcpx *acc, const fftcpx *x, const uint16_t *h, float scale, int n) {
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        uint16x4x2_t hh = vld2_u16(&h[i*2]);
+        float32x4_t hre = vmulq_n_f32(vreinterpretq_f32_u32(vshll_n_u16(hh.val[0], 16)), scale);
+        float32x4_t him = vmulq_n_f32(vreinterpretq_f32_u32(vshll_n_u16(hh.val[1], 16)), scale);
+        float32x4x2_t xv = vld2q_f32((const float*) &x[i]);
+        float32x4x2_t av = vld2q_f32((const float*) &acc[i]);
+        av.val[0] = vfmaq_f32(av.val[0], xv.val[0], hre);
+        av.val[0] = vfmsq_f32(av.val[0], xv.val[1], him);
+        av.val[1] = vfmaq_f32(av.val[1], xv.val[0], him);
+        av.val[1] = vfmaq_f32(av.val[1], xv.val[1], hre);
+        vst2q_f32((float*) &acc[i], av);
+    }
+
+    cmacbfloat_scalar(&acc[i], &x[i], &h[i*2], scale, n-i);
+}
+
+static void addscaled_neon(float *dst, const float *src, float scale, int n) {
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4)
+        vst1q_f32(&dst[i], vfmaq_n_f32(vld1q_f32(&dst[i]), vld1q_f32(&src[i]), scale));
+
+    addscaled_scalar(&dst[i], &src[i], scale, n-i);
+}
+
+static void interleave_neon(float *out, const float *const *in, int channels, int n) {
+    int i = 0;
+
+    if ( channels == 2 ) {
+        for (; i + 4 <= n; i += 4) {
+            float32x4x2_t lr = { { vld1q_f32(&in[0][i]), vld1q_f32(&in[1][i]) } };
+            vst2q_f32(&out[i*2], lr);
+        }
+        const float *rest[2] = { &in[0][i], &in[1][i] };
+        interleave_scalar(&out[i*2], rest, 2, n-i);
+        return;
+    }
+
+    interleave_scalar(out, in, channels, n);
+}
+
+static void fir_neon(float *out, const float *x, const float *h, int taps, int n) {
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        float32x4_t a0 = vdupq_n_f32(0), a1 = vdupq_n_f32(0), a2 = vdupq_n_f32(0), a3 = vdupq_n_f32(0);
+        for (int k = 0; k < taps; k++) {
+            const float *xk = &x[i+k];
+            float hk = h[k];
+            a0 = vfmaq_n_f32(a0, vld1q_f32(xk), hk);
+            a1 = vfmaq_n_f32(a1, vld1q_f32(xk+4), hk);
+            a2 = vfmaq_n_f32(a2, vld1q_f32(xk+8), hk);
+            a3 = vfmaq_n_f32(a3, vld1q_f32(xk+12), hk);
+        }
+        vst1q_f32(&out[i], a0);
+        vst1q_f32(&out[i+4], a1);
+        vst1q_f32(&out[i+8], a2);
+        vst1q_f32(&out[i+12], a3);
+    }
+
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t a = vdupq_n_f32(0);
+        for (int k = 0; k < taps; k++)
+            a = vfmaq_n_f32(a, vld1q_f32(&x[i+k]), h[k]);
+        vst1q_f32(&out[i], a);
+    }
+
+    fir_scalar(&out[i], &x[i], h, taps, n-i);
+}
+
+static float dot_neon(const float *x, const float *h, int n) {
+    float32x4_t a0 = vdupq_n_f32(0), a1 = vdupq_n_f32(0);
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        a0 = vfmaq_f32(a0, vld1q_f32(&x[i]), vld1q_f32(&h[i]));
+        a1 = vfmaq_f32(a1, vld1q_f32(&x[i+4]), vld1q_f32(&h[i+4]));
+    }
+
+    return vaddvq_f32(vaddq_f32(a0, a1)) + dot_scalar(&x[i], &h[i], n-i);
+}
+
+#endif
+
+kernelset kernels = { "scalar", cmac_scalar, cmachalf_scalar, cmacbfloat_scalar, addscaled_scalar, clippeak_scalar,
+                      fir_scalar, interleave_scalar, dot_scalar };
+
+const char * kernels_name(void) {
+    return kernels.name;
+}
+
+// runs before main, so the table never changes while threads are using it
+__attribute__((constructor))
+static void kernels_init(void) {
+    const char *want = getenv("CONVOLUTE_SIMD");
+
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+
+    if ( want && strcmp(want, "scalar") == 0 )
+        return;
+
+    if ( __builtin_cpu_supports("sse2") ) {
+        kernelset k = { "sse2", cmac_sse2, cmachalf_scalar, cmacbfloat_sse2, addscaled_sse2, clippeak_sse2, fir_sse2,
+                        interleave_sse2, dot_sse2 };
+        kernels = k;
+    }
+    if ( want && strcmp(want, "sse2") == 0 )
+        return;
+
+    if ( __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ) {
+        kernelset k = { "avx2", cmac_avx2, cmachalf_avx2, cmacbfloat_avx2, addscaled_avx2, clippeak_avx2, fir_avx2,
+                        interleave_avx2, dot_avx2 };
+        if ( !__builtin_cpu_supports("f16c") )
+            k.cmachalf = cmachalf_scalar;
+        kernels = k;
+    }
+    if ( want && strcmp(want, "avx2") == 0 )
+        return;
+
+    if ( __builtin_cpu_supports("avx512f") ) {
+        kernelset k = { "avx512", cmac_avx512, cmachalf_avx512, cmacbfloat_avx512, addscaled_avx512, clippeak_avx512,
+                        fir_avx512, interleave_avx2, dot_avx512 };
+        kernels = k;
+    }
+#elif defined(KERNELS_NEON)
+    if ( want && strcmp(want, "scalar") == 0 )
+        return;
+
+    kernelset k = { "neon", cmac_neon, cmachalf_neon, cmacbfloat_neon, addscaled_neon, clippeak_scalar, fir_neon,
+                    interleave_neon, dot_neon };
+    kernels = k;
+#else
+    (void) want;
+#endif
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef __KERNELS_H__
+#define __KERNELS_H__
+
+#include <stdint.h>
+
+#include "fft.h"
+
+// the inner loops outside the ffts, picked once at startup for the best
+// instruction set the cpu has. every thread uses the same ones, so results
+// don't depend on the thread count.
+typedef struct {
+    const char *name;
+
+    // acc[i] += x[i] * h[i] for n complex bins
+    void (*cmac)(fftcpx *acc, const fftcpx *x, const fftcpx *h, int n);
+
+    // the same with h stored as float16 or bfloat16 re,im pairs, see half.h,
+    // and multiplied by scale as it's expanded
+    void (*cmachalf)(fftcpx *acc, const fftcpx *x, const uint16_t *h, float scale, int n);
+    void (*cmacbfloat)(fftcpx *acc, const fftcpx *x, const uint16_t *h, float scale, int n);
+
+    // dst[i] += src[i] * scale for n samples
+    void (*addscaled)(float *dst, const float *src, float scale, int n);
+
+    // data[i] *= gain, then clip to [-1,1]. raises *peak to the largest
+    // magnitude seen before clipping and returns the number of samples clipped.
+    int (*clippeak)(float *data, int n, float gain, float *peak);
+
+    // out[i] = sum of x[i+k] * h[k] over taps k, for n outputs. h is the
+    // impulse reversed, so x holds taps-1 frames of history before the first.
+    void (*fir)(float *out, const float *x, const float *h, int taps, int n);
+
+    // out[i*channels + c] = in[c][i] for n frames
+    void (*interleave)(float *out, const float *const *in, int channels, int n);
+
+    // the sum of x[i] * h[i] over n samples
+    float (*dot)(const float *x, const float *h, int n);
+} kernelset;
+
+extern kernelset kernels;
+
+// names the kernel set in use, after the CONVOLUTE_SIMD environment variable
+// (scalar, sse2, avx2, avx512 or neon) has had its chance to override the cpu check
+const char * kernels_name(void);
+
+#endif
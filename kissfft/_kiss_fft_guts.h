@@ -129,9 +129,9 @@ struct kiss_fft_state{
 #  define KISS_FFT_SIN(phase)  floor(.5+SAMP_MAX * sin (phase))
 #  define HALF_OF(x) ((x)>>1)
 #elif defined(USE_SIMD)
-#  define KISS_FFT_COS(phase) _mm_set1_ps( cos(phase) )
-#  define KISS_FFT_SIN(phase) _mm_set1_ps( sin(phase) )
-#  define HALF_OF(x) ((x)*_mm_set1_ps(.5))
+#  define KISS_FFT_COS(phase) KISS_FFT_SPLAT( (float) cos(phase) )
+#  define KISS_FFT_SIN(phase) KISS_FFT_SPLAT( (float) sin(phase) )
+#  define HALF_OF(x) ((x)*KISS_FFT_SPLAT(.5f))
 #else
 #  define KISS_FFT_COS(phase) (kiss_fft_scalar) cos(phase)
 #  define KISS_FFT_SIN(phase) (kiss_fft_scalar) sin(phase)
@@ -24,10 +24,21 @@ extern "C" {
 */
 
 #ifdef USE_SIMD
-# include <xmmintrin.h>
-# define kiss_fft_scalar __m128
-#define KISS_FFT_MALLOC(nbytes) _mm_malloc(nbytes,16)
-#define KISS_FFT_FREE _mm_free
+# if defined(__SSE__)
+#  include <xmmintrin.h>
+#  define kiss_fft_scalar __m128
+#  define KISS_FFT_SPLAT(x) _mm_set1_ps(x)
+#  define KISS_FFT_MALLOC(nbytes) _mm_malloc(nbytes,16)
+#  define KISS_FFT_FREE _mm_free
+# else
+/* four float lanes through the gcc/clang vector extension, e.g. for NEON.
+   malloc is 16 byte aligned on the 64 bit targets this is built for. */
+typedef float kiss_fft_v4sf __attribute__((vector_size(16)));
+#  define kiss_fft_scalar kiss_fft_v4sf
+#  define KISS_FFT_SPLAT(x) ((kiss_fft_v4sf){ (x), (x), (x), (x) })
+#  define KISS_FFT_MALLOC malloc
+#  define KISS_FFT_FREE free
+# endif
 #else	
 #define KISS_FFT_MALLOC malloc
 #define KISS_FFT_FREE free
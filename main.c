@@ -14,13 +14,241 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
 #include <convolute.h>
+#include <fft.h>
+#include <partconv.h>
 #include <die.h>
+#include <stats.h>
+#include <trim.h>
+
+#define USAGE "Usage: convolute [--stats[=file]] [-Dsv] [-j threads] [-l latency] [-M megabytes] [-p estimate|measure|patient] [-P f32|f16|bf16] [-n dBFS|noclip] [-r channels] [-T auto|dB] input impulse output amp\n" \
+              "       convolute [-Dv] [-j threads] [-l latency] [-M megabytes] [-p estimate|measure|patient] [-P f32|f16|bf16] [-r channels] [-T auto|dB] -|input impulse -|output amp\n" \
+              "       convolute prepare [-v] [-l latency] [-M megabytes] [-p estimate|measure|patient] [-P f32|f16|bf16] [-R rate] [-T auto|dB] impulse spectra\n" \
+              "       convolute batch [options] impulse amp manifest\n" \
+              "       convolute batch [options] -d outdir impulse amp input..."
+
+// --stats[=file] anywhere on the command line reports where the time went
+// as json, to stderr or the file, once the run is done
+static char * takestats(int *argc, char **argv, int *wanted) {
+    char *path = NULL;
+    int n = 1;
+
+    *wanted = 0;
+    for (int i = 1; i < *argc; i++) {
+        if ( strcmp(argv[i], "--stats") == 0 ) {
+            *wanted = 1;
+        } else if ( strncmp(argv[i], "--stats=", 8) == 0 ) {
+            *wanted = 1;
+            path = &argv[i][8];
+        } else {
+            argv[n++] = argv[i];
+        }
+    }
+    *argc = n;
+    argv[n] = NULL;
+
+    return path;
+}
+
+static void printstats(char *path) {
+    FILE *f = stderr;
+
+    if ( path && (f = fopen(path, "w")) == NULL )
+        diem("Couldn't open stats file for writing", path);
+
+    stats_print(f);
+
+    if ( path && fclose(f) )
+        diem("Couldn't write stats file", path);
+}
 
 int main(int argc, char **argv) {
-    if ( argc != 5 )
-        die("Bad number of arguments. Usage: convolute input impulse output amp");
+    convopts opts;
+    int c;
+
+    int stats;
+    char *statspath = takestats(&argc, argv, &stats);
+    if ( stats )
+        stats_start();
+
+    // convolute prepare ... takes the same options, less those about the
+    // output. convolute batch ... takes them all, and an output directory.
+    int preparing = argc > 1 && strcmp(argv[1], "prepare") == 0;
+    int batching = argc > 1 && strcmp(argv[1], "batch") == 0;
+    char *outdir = NULL;
+    if ( preparing || batching ) {
+        argc--;
+        argv++;
+    }
+
+    opts.latency = 0;
+    opts.threads = 1;
+    opts.scratch = 0;
+    opts.planning = FFT_MEASURE;
+    // timing the partition sizes can pick a different one from run to run,
+    // and with it different output, so that's only done when asked for
+    opts.planeffort = FFT_ESTIMATE;
+    opts.normalize = NORMALIZE_OFF;
+    opts.peakdb = 0;
+    opts.rawchannels = 0;
+    opts.memcap = 0;
+    opts.verbose = 0;
+    opts.direct = 0;
+    opts.samplerate = 0;
+    opts.trimdb = 0;
+    opts.precision = PC_FLOAT32;
+
+    while ( (c = getopt(argc, argv, preparing ? "l:M:p:P:R:T:v" : batching ? "Dd:j:l:M:n:p:P:sT:v" : "Dj:l:M:n:p:P:r:sT:v")) != -1 ) {
+        switch ( c ) {
+            case 'D':
+                // time domain convolution, however long the impulse
+                opts.direct = 1;
+                break;
+            case 'd':
+                outdir = optarg;
+                break;
+            case 'j':
+                opts.threads = atoi(optarg);
+                if ( opts.threads < 1 )
+                    die("Thread count must be at least 1");
+                break;
+            case 'l':
+                opts.latency = atoi(optarg);
+                // partitions double as fft half-lengths, keep them to powers of two
+                if ( opts.latency < 16 || (opts.latency & (opts.latency-1)) )
+                    die("Latency must be a power of two of at least 16");
+                break;
+            case 'M':
+                // the planner's budget for spectra, delay lines and buffers
+                if ( atoi(optarg) < 1 )
+                    die("Bad memory cap");
+                opts.memcap = (size_t) atoi(optarg) << 20;
+                break;
+            case 'n':
+                // a peak level to normalize to, or just enough to not clip
+                if ( strcmp(optarg, "noclip") == 0 ) {
+                    opts.normalize = NORMALIZE_NOCLIP;
+                } else {
+                    char *end;
+                    opts.normalize = NORMALIZE_PEAK;
+                    opts.peakdb = strtof(optarg, &end);
+                    if ( end == optarg || *end != '\0' )
+                        die("Normalization target must be a peak level in dBFS or noclip");
+                }
+                break;
+            case 'p':
+                if ( strcmp(optarg, "estimate") == 0 )
+                    opts.planning = FFT_ESTIMATE;
+                else if ( strcmp(optarg, "measure") == 0 )
+                    opts.planning = FFT_MEASURE;
+                else if ( strcmp(optarg, "patient") == 0 )
+                    opts.planning = FFT_PATIENT;
+                else
+                    die("Planning must be one of estimate, measure or patient");
+                opts.planeffort = opts.planning;
+                break;
+            case 'P':
+                // half the memory for the spectra, for some noise under the output
+                if ( strcmp(optarg, "f32") == 0 )
+                    opts.precision = PC_FLOAT32;
+                else if ( strcmp(optarg, "f16") == 0 )
+                    opts.precision = PC_FLOAT16;
+                else if ( strcmp(optarg, "bf16") == 0 )
+                    opts.precision = PC_BFLOAT16;
+                else
+                    die("Precision must be one of f32, f16 or bf16");
+                break;
+            case 'r':
+                // the input is bare samples, at the impulse's sample rate
+                opts.rawchannels = atoi(optarg);
+                if ( opts.rawchannels < 1 )
+                    die("Raw input needs at least 1 channel");
+                break;
+            case 'R':
+                // a spectra file is only good for input at its rate
+                opts.samplerate = atoi(optarg);
+                if ( opts.samplerate < 1 )
+                    die("Bad sample rate");
+                break;
+            case 's':
+                opts.scratch = 1;
+                break;
+            case 'T':
+                // cut the impulse where its decay meets the noise, or falls this far
+                if ( strcmp(optarg, "auto") == 0 ) {
+                    opts.trimdb = TRIM_NOISEFLOOR;
+                } else {
+                    char *end;
+                    opts.trimdb = strtof(optarg, &end);
+                    if ( end == optarg || *end != '\0' || opts.trimdb <= 0 )
+                        die("Trim must be auto or a positive level in dB");
+                }
+                break;
+            case 'v':
+                opts.verbose = 1;
+                break;
+            default:
+                die(USAGE);
+        }
+    }
+
+    if ( preparing ) {
+        if ( argc - optind != 2 )
+            die("Bad number of arguments. " USAGE);
+        prepare(argv[optind], argv[optind+1], &opts);
+        if ( stats )
+            printstats(statspath);
+        return 0;
+    }
+
+    if ( batching ) {
+        char **inputs, **outputs;
+        int nfiles;
+
+        if ( outdir ? argc - optind < 3 : argc - optind != 3 )
+            die("Bad number of arguments. " USAGE);
+        opts.amp = atof(argv[optind+1]);
+
+        if ( outdir ) {
+            // every input goes to a file of the same name in outdir
+            nfiles = argc - optind - 2;
+            inputs = &argv[optind+2];
+            if ( (outputs = malloc(sizeof(char*) * nfiles)) == NULL )
+                die("Couldn't malloc space for output paths");
+            for (int i = 0; i < nfiles; i++) {
+                char *base = strrchr(inputs[i], '/') ? strrchr(inputs[i], '/') + 1 : inputs[i];
+                if ( (outputs[i] = malloc(strlen(outdir) + strlen(base) + 2)) == NULL )
+                    die("Couldn't malloc space for output paths");
+                sprintf(outputs[i], "%s/%s", outdir, base);
+            }
+        } else {
+            nfiles = readmanifest(argv[optind+2], &inputs, &outputs);
+        }
+
+        int failed = convolutebatch(argv[optind], inputs, outputs, nfiles, &opts);
+        if ( failed )
+            fprintf(stderr, "%d of %d files failed\n", failed, nfiles);
+        if ( stats )
+            printstats(statspath);
+        return failed ? EXIT_FAILURE : 0;
+    }
+
+    if ( argc - optind != 4 )
+        die("Bad number of arguments. " USAGE);
+
+    opts.amp = atof(argv[optind+3]);
+
+    convolute(argv[optind], argv[optind+1], argv[optind+2], &opts);
+
+    if ( stats )
+        printstats(statspath);
 
-    convolute(argv[1], argv[2], argv[3], atof(argv[4]));
+    return 0;
 }
 
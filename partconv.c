@@ -0,0 +1,726 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/mman.h>
+
+#include "fft.h"
+#include "half.h"
+#include "kernels.h"
+#include "partconv.h"
+#include "pool.h"
+#include "stats.h"
+
+// each low latency stage before the last gets this many partitions, and the
+// next stage's partitions are this much larger. a stage's first output is
+// needed blocksize-latency samples before its transform finishes, and this
+// ratio keeps every stage's offset at least that far into the impulse.
+#define LOWLATENCY_GROWTH 4
+
+// low latency stages with more partitions than this are cut into chunks of
+// this many, so that one block's spectral multiply can run on several threads
+#define LOWLATENCY_CHUNKPARTS 4
+
+size_t pcfilter_binbytes(int precision) {
+    return precision == PC_FLOAT32 ? sizeof(fftcpx) : sizeof(uint16_t) * 2;
+}
+
+size_t pcfilter_stagebytes(const pcfilter *f, const pcstage *s) {
+    size_t spectra = (size_t) s->parts * f->channels;
+    size_t bytes = pcfilter_binbytes(f->precision) * s->binstride * spectra;
+
+    return f->precision == PC_FLOAT32 ? bytes : bytes + sizeof(float) * spectra;
+}
+
+// transforms the window in space and stores it as spectrum at of the stage
+// at 16 bits. the scale is the spectrum's largest component, so whatever
+// its level it uses the whole range of the format.
+static void packhalves(pcfilter *f, pcstage *s, int at, fftcpx *bins, fftplan *plan, float *space) {
+    uint16_t *dst = &s->halves[(size_t) at * s->binstride * 2];
+    float peak = 0;
+
+    fft_forward(plan, space, bins);
+
+    int n = s->blocksize+1;
+    for (int i = 0; i < n; i++) {
+        if ( fabsf(bins[i].r) > peak )
+            peak = fabsf(bins[i].r);
+        if ( fabsf(bins[i].i) > peak )
+            peak = fabsf(bins[i].i);
+    }
+
+    float inverse = peak > 0 ? 1 / peak : 0;
+    for (int i = 0; i < n; i++) {
+        if ( f->precision == PC_FLOAT16 ) {
+            dst[i*2] = half_fromfloat(bins[i].r * inverse);
+            dst[i*2+1] = half_fromfloat(bins[i].i * inverse);
+        } else {
+            dst[i*2] = bfloat_fromfloat(bins[i].r * inverse);
+            dst[i*2+1] = bfloat_fromfloat(bins[i].i * inverse);
+        }
+    }
+    memset(&dst[n*2], 0, sizeof(uint16_t) * 2 * (s->binstride - n));
+    s->scales[at] = peak;
+}
+
+// returns 0, or -1 if out of memory or stages
+static int addstage(pcfilter *f, const float *ir, int irlen, int blocksize, int offset, int parts) {
+    if ( f->nstages == PC_MAXSTAGES )
+        return -1;
+
+    pcstage *s = &f->stages[f->nstages++];
+    int channels = f->channels;
+
+    s->blocksize = blocksize;
+    s->offset = offset;
+    s->parts = parts;
+    s->chunkparts = parts;
+    s->chunks = 1;
+    s->binstride = fft_binstride(blocksize*2);
+
+    // at 16 bits each spectrum is transformed into one scratch spectrum and
+    // packed down from there
+    fftcpx *bins = NULL;
+    if ( f->precision == PC_FLOAT32 ) {
+        if ( (s->spectra = fft_malloc(pcfilter_stagebytes(f, s))) == NULL )
+            return -1;
+    } else {
+        if ( (s->halves = fft_malloc(pcfilter_stagebytes(f, s))) == NULL )
+            return -1;
+        s->scales = (float *) &s->halves[(size_t) s->binstride * 2 * parts * channels];
+        if ( (bins = fft_malloc(sizeof(fftcpx) * s->binstride)) == NULL )
+            return -1;
+    }
+
+    fftplan *plan = fft_plan(blocksize*2);
+    float *space = fft_malloc(sizeof(float) * blocksize*2);
+    if ( plan == NULL || space == NULL ) {
+        fft_plan_free(plan);
+        fft_free(space);
+        fft_free(bins);
+        return -1;
+    }
+
+    // fold the 1/n normalization of the inverse transform in here, once
+    float scale = 1.0 / (blocksize*2);
+
+    for (int c = 0; c < channels; c++) {
+        for (int p = 0; p < parts; p++) {
+            int start = offset + p*blocksize;
+            int len = irlen - start < blocksize ? irlen - start : blocksize;
+            if ( len < 0 )
+                len = 0;
+
+            for (int i = 0; i < len; i++)
+                space[i] = ir[(start+i)*channels + c] * scale;
+            for (int i = len; i < blocksize*2; i++)
+                space[i] = 0;
+
+            if ( bins )
+                packhalves(f, s, c*parts + p, bins, plan, space);
+            else
+                fft_forward(plan, space, &s->spectra[(c*parts + p) * s->binstride]);
+        }
+    }
+    stats_fft(blocksize*2, parts * channels);
+
+    fft_free(bins);
+    fft_free(space);
+    fft_plan_free(plan);
+
+    return 0;
+}
+
+static pcfilter * newfilter(int irlen, int channels, int latency, int precision) {
+    pcfilter *f;
+
+    if ( (f = calloc(1, sizeof(*f))) == NULL )
+        return NULL;
+
+    f->latency = latency;
+    f->length = irlen;
+    f->channels = channels;
+    f->nstages = 0;
+    f->precision = precision;
+    f->map = NULL;
+    f->maplen = 0;
+
+    return f;
+}
+
+pcfilter * pcfilter_new(const float *ir, int irlen, int channels, int blocksize, int precision) {
+    pcfilter *f = newfilter(irlen, channels, blocksize, precision);
+    if ( f == NULL )
+        return NULL;
+
+    int parts = (irlen + blocksize - 1) / blocksize;
+    if ( parts < 1 )
+        parts = 1;
+
+    if ( addstage(f, ir, irlen, blocksize, 0, parts) ) {
+        pcfilter_free(f);
+        return NULL;
+    }
+
+    return f;
+}
+
+pcfilter * pcfilter_new_lowlatency(const float *ir, int irlen, int channels, int latency, int maxblock, int precision) {
+    pcfilter *f = newfilter(irlen, channels, latency, precision);
+    if ( f == NULL )
+        return NULL;
+
+    int blocksize = latency;
+    int offset = 0;
+    do {
+        int parts = LOWLATENCY_GROWTH;
+        int left = (irlen - offset + blocksize - 1) / blocksize;
+
+        if ( blocksize*LOWLATENCY_GROWTH > maxblock || left <= parts )
+            parts = left < 1 ? 1 : left;
+
+        if ( addstage(f, ir, irlen, blocksize, offset, parts) ) {
+            pcfilter_free(f);
+            return NULL;
+        }
+
+        pcstage *s = &f->stages[f->nstages-1];
+        if ( parts > LOWLATENCY_CHUNKPARTS ) {
+            s->chunkparts = LOWLATENCY_CHUNKPARTS;
+            s->chunks = (parts + LOWLATENCY_CHUNKPARTS - 1) / LOWLATENCY_CHUNKPARTS;
+        }
+
+        offset += parts*blocksize;
+        blocksize *= LOWLATENCY_GROWTH;
+    } while ( offset < irlen );
+
+    return f;
+}
+
+pcfilter * pcfilter_new_direct(const float *ir, int irlen, int channels, int blocksize) {
+    pcfilter *f = newfilter(irlen, channels, blocksize, PC_FLOAT32);
+    if ( f == NULL )
+        return NULL;
+
+    if ( (f->taps = fft_malloc(sizeof(float) * irlen * channels)) == NULL ) {
+        pcfilter_free(f);
+        return NULL;
+    }
+
+    // reversed, so each output is a plain dot product with the input before it
+    for (int c = 0; c < channels; c++)
+        for (int k = 0; k < irlen; k++)
+            f->taps[c*irlen + k] = ir[(irlen-1-k)*channels + c];
+
+    return f;
+}
+
+void pcfilter_free(pcfilter *f) {
+    if ( f == NULL )
+        return;
+
+    if ( f->map ) {
+        munmap(f->map, f->maplen);
+    } else {
+        for (int s = 0; s < f->nstages; s++) {
+            fft_free(f->stages[s].spectra);
+            fft_free(f->stages[s].halves);
+        }
+    }
+    fft_free(f->taps);
+    free(f);
+}
+
+int partconv_outchannels(int inchannels, int irchannels) {
+    if ( inchannels == irchannels || irchannels == 1 )
+        return inchannels;
+    if ( inchannels == 1 )
+        return irchannels;
+    return 0;
+}
+
+partconv * partconv_new(pcfilter *f, int inchannels, pool *workers) {
+    partconv *pc;
+
+    if ( partconv_outchannels(inchannels, f->channels) == 0 )
+        return NULL;
+
+    // zeroed, so partconv_free can clean up after a failure at any point
+    if ( (pc = calloc(1, sizeof(*pc))) == NULL )
+        return NULL;
+
+    pc->filter = f;
+    pc->inchannels = inchannels;
+    pc->outchannels = partconv_outchannels(inchannels, f->channels);
+    pc->ringlen = 0;
+    pc->ringpos = 0;
+
+    // a batch of blocks is spread over the workers, one block each, so every
+    // block of a batch needs its own slot in the delay line on top of parts.
+    // a batched block sums all its partitions in one go, so a low latency
+    // filter that came out as one chunked stage stays on the chunk path,
+    // where the chunks are summed in the same order at any thread count.
+    pc->workers = workers;
+    pc->maxbatch = workers && f->nstages == 1 && f->stages[0].chunks == 1 ? pool_threads(workers) : 1;
+
+    for (int s = 0; s < f->nstages; s++) {
+        pcstagestate *ss = &pc->stages[s];
+        int n = f->stages[s].blocksize*2;
+        int stride = f->stages[s].binstride;
+
+        ss->plan = fft_plan(n);
+        ss->slots = f->stages[s].parts + pc->maxbatch - 1;
+        ss->fdlpos = 0;
+        ss->fill = 0;
+
+        ss->inspace = fft_malloc(sizeof(float) * n * inchannels);
+        ss->fdl = fft_malloc(sizeof(fftcpx) * stride * ss->slots * inchannels);
+        ss->partials = fft_malloc(sizeof(fftcpx) * stride * f->stages[s].chunks * pc->outchannels);
+        ss->revspace = fft_malloc(sizeof(float) * n);
+
+        if ( ss->plan == NULL || ss->inspace == NULL || ss->fdl == NULL || ss->partials == NULL || ss->revspace == NULL ) {
+            partconv_free(pc);
+            return NULL;
+        }
+
+        memset(ss->inspace, 0, sizeof(float) * n * inchannels);
+        memset(ss->fdl, 0, sizeof(fftcpx) * stride * ss->slots * inchannels);
+
+        // a stage's block lands offset-blocksize+latency frames ahead of
+        // the current output position, and runs for blocksize frames
+        int reach = f->stages[s].offset + f->latency;
+        while ( pc->ringlen < reach )
+            pc->ringlen = pc->ringlen ? pc->ringlen*2 : 1;
+    }
+    pc->ringmask = pc->ringlen - 1;
+
+    if ( (pc->rows = calloc(pc->outchannels, sizeof(float*))) == NULL ) {
+        partconv_free(pc);
+        return NULL;
+    }
+
+    if ( f->taps ) {
+        size_t histlen = (size_t) f->length - 1 + f->latency;
+        pc->history = fft_malloc(sizeof(float) * histlen * inchannels);
+        pc->firout = fft_malloc(sizeof(float) * f->latency * pc->outchannels);
+        if ( pc->history == NULL || pc->firout == NULL ) {
+            partconv_free(pc);
+            return NULL;
+        }
+        memset(pc->history, 0, sizeof(float) * histlen * inchannels);
+    }
+
+    // a direct filter has no stages landing ahead, so no ring
+    if ( pc->ringlen ) {
+        if ( (pc->ring = fft_malloc(sizeof(float) * pc->ringlen * pc->outchannels)) == NULL ) {
+            partconv_free(pc);
+            return NULL;
+        }
+        memset(pc->ring, 0, sizeof(float) * pc->ringlen * pc->outchannels);
+    }
+
+    if ( pc->maxbatch > 1 ) {
+        int threads = pool_threads(pc->workers);
+        int n = f->stages[0].blocksize*2;
+        int stride = f->stages[0].binstride;
+
+        pc->wplans = calloc(threads, sizeof(fftplan*));
+        pc->wspace = fft_malloc(sizeof(float) * n * threads);
+        pc->waccum = fft_malloc(sizeof(fftcpx) * stride * threads);
+        if ( pc->wplans == NULL || pc->wspace == NULL || pc->waccum == NULL ) {
+            partconv_free(pc);
+            return NULL;
+        }
+
+        for (int i = 0; i < threads; i++) {
+            if ( (pc->wplans[i] = fft_plan(n)) == NULL ) {
+                partconv_free(pc);
+                return NULL;
+            }
+        }
+    }
+
+    return pc;
+}
+
+// multiply the delayed input spectra against partitions [first,first+count)
+// of impulse channel hc and sum them into accum. slot holds the newest
+// spectrum, which goes with partition 0.
+static void mac(pcfilter *f, pcstage *s, fftcpx *accum, fftcpx *fdl, int slot, int slots, int hc, int first, int count) {
+    int bins = s->blocksize+1;
+
+    slot = (slot - first % slots + slots) % slots;
+
+    memset(accum, 0, sizeof(fftcpx) * bins);
+    for (int p = first; p < first+count; p++) {
+        fftcpx *x = &fdl[slot * s->binstride];
+        size_t at = (size_t) hc * s->parts + p;
+
+        // 16 bit spectra are expanded as they're multiplied, they're never whole floats in memory
+        if ( f->precision == PC_FLOAT16 )
+            kernels.cmachalf(accum, x, &s->halves[at * s->binstride * 2], s->scales[at], bins);
+        else if ( f->precision == PC_BFLOAT16 )
+            kernels.cmacbfloat(accum, x, &s->halves[at * s->binstride * 2], s->scales[at], bins);
+        else
+            kernels.cmac(accum, x, &s->spectra[at * s->binstride], bins);
+
+        if ( --slot < 0 )
+            slot = slots-1;
+    }
+}
+
+static fftcpx * fdlof(pcstage *s, pcstagestate *ss, int c) {
+    return &ss->fdl[c * ss->slots * s->binstride];
+}
+
+typedef struct {
+    partconv *pc;
+    int stage;
+} chunkjob;
+
+// one chunk of partitions for one output channel of a stage's current block
+static void macchunk(void *ctx, int task, int worker) {
+    chunkjob *cj = ctx;
+    partconv *pc = cj->pc;
+    pcfilter *f = pc->filter;
+    pcstage *s = &f->stages[cj->stage];
+    pcstagestate *ss = &pc->stages[cj->stage];
+    int c = task / s->chunks;
+    int k = task % s->chunks;
+    int first = k * s->chunkparts;
+    int count = s->parts - first < s->chunkparts ? s->parts - first : s->chunkparts;
+
+    mac(f, s, &ss->partials[task * s->binstride], fdlof(s, ss, pc->inchannels == 1 ? 0 : c), ss->fdlpos, ss->slots,
+            f->channels == 1 ? 0 : c, first, count);
+}
+
+// one output channel of a direct filter's current block
+static void firchannel(void *ctx, int c, int worker) {
+    partconv *pc = ctx;
+    pcfilter *f = pc->filter;
+    size_t histlen = (size_t) f->length - 1 + f->latency;
+
+    kernels.fir(&pc->firout[c * f->latency], &pc->history[(pc->inchannels == 1 ? 0 : c) * histlen],
+            &f->taps[(f->channels == 1 ? 0 : c) * f->length], f->length, f->latency);
+}
+
+// every output of a direct filter depends only on input already seen, so a
+// block comes out as soon as it goes in
+static void directprocess(partconv *pc, const float *in, float *out) {
+    pcfilter *f = pc->filter;
+    int latency = f->latency;
+    int keep = f->length - 1;
+    int inch = pc->inchannels;
+    int outch = pc->outchannels;
+    statclock clock;
+
+    for (int c = 0; c < inch; c++) {
+        float *dst = &pc->history[c * (keep + latency) + keep];
+        for (int i = 0; i < latency; i++)
+            dst[i] = in[i*inch + c];
+    }
+
+    stats_begin(&clock);
+    if ( pc->workers && outch > 1 ) {
+        pool_run(pc->workers, firchannel, pc, outch);
+    } else {
+        for (int c = 0; c < outch; c++)
+            firchannel(pc, c, 0);
+    }
+    stats_end(&clock, STAT_MULTIPLY);
+
+    stats_begin(&clock);
+    for (int c = 0; c < outch; c++)
+        pc->rows[c] = &pc->firout[c*latency];
+    kernels.interleave(out, (const float *const *) pc->rows, outch, latency);
+    stats_end(&clock, STAT_OVERLAP);
+
+    // the newest length-1 frames are the next block's history
+    for (int c = 0; c < inch; c++) {
+        float *h = &pc->history[c * (keep + latency)];
+        memmove(h, &h[latency], sizeof(float) * keep);
+    }
+}
+
+// adds n frames of an output channel into the ring, ahead frames past
+// where it's next handed out from. the cost is in n alone, whatever the
+// length of the ring.
+static void ringadd(partconv *pc, int c, int ahead, const float *src, int n) {
+    float *ring = &pc->ring[(size_t) c * pc->ringlen];
+    int at = (pc->ringpos + ahead) & pc->ringmask;
+    int first = pc->ringlen - at < n ? pc->ringlen - at : n;
+
+    kernels.addscaled(&ring[at], src, 1, first);
+    kernels.addscaled(ring, &src[first], 1, n-first);
+}
+
+// hands out the next frames of every channel, interleaved, and clears them
+// for the blocks still to land there. at most two pieces, around the wrap.
+static void ringdrain(partconv *pc, float *out, int frames) {
+    int outch = pc->outchannels;
+
+    while ( frames > 0 ) {
+        int n = pc->ringlen - pc->ringpos < frames ? pc->ringlen - pc->ringpos : frames;
+
+        for (int c = 0; c < outch; c++)
+            pc->rows[c] = &pc->ring[(size_t) c * pc->ringlen + pc->ringpos];
+        kernels.interleave(out, (const float *const *) pc->rows, outch, n);
+        for (int c = 0; c < outch; c++)
+            memset(pc->rows[c], 0, sizeof(float) * n);
+
+        pc->ringpos = (pc->ringpos + n) & pc->ringmask;
+        out += n * outch;
+        frames -= n;
+    }
+}
+
+void partconv_process(partconv *pc, const float *in, float *out) {
+    pcfilter *f = pc->filter;
+    int latency = f->latency;
+    int inch = pc->inchannels;
+    int outch = pc->outchannels;
+    statclock clock;
+
+    if ( f->taps ) {
+        directprocess(pc, in, out);
+        return;
+    }
+
+    for (int st = 0; st < f->nstages; st++) {
+        pcstage *s = &f->stages[st];
+        pcstagestate *ss = &pc->stages[st];
+        int b = s->blocksize;
+
+        // deinterleave the new frames into the second half of each window
+        for (int c = 0; c < inch; c++) {
+            float *dst = &ss->inspace[c*b*2 + b + ss->fill];
+            for (int i = 0; i < latency; i++)
+                dst[i] = in[i*inch + c];
+        }
+        ss->fill += latency;
+
+        if ( ss->fill < b )
+            continue;
+
+        // transform each input channel once; the newest spectrum goes into
+        // the slot of the oldest one
+        ss->fdlpos = (ss->fdlpos + 1) % ss->slots;
+        stats_begin(&clock);
+        for (int c = 0; c < inch; c++)
+            fft_forward(ss->plan, &ss->inspace[c*b*2], &fdlof(s, ss, c)[ss->fdlpos * s->binstride]);
+        stats_end(&clock, STAT_FORWARD);
+        stats_fft(b*2, inch);
+
+        // every chunk of every output channel is independent until the sums
+        chunkjob cj = { pc, st };
+        stats_begin(&clock);
+        if ( pc->workers && outch * s->chunks > 1 ) {
+            pool_run(pc->workers, macchunk, &cj, outch * s->chunks);
+        } else {
+            for (int i = 0; i < outch * s->chunks; i++)
+                macchunk(&cj, i, 0);
+        }
+        stats_end(&clock, STAT_MULTIPLY);
+
+        for (int c = 0; c < outch; c++) {
+            // sum the chunks in order, so the result doesn't depend on the thread count
+            fftcpx *accum = &ss->partials[c * s->chunks * s->binstride];
+            stats_begin(&clock);
+            for (int k = 1; k < s->chunks; k++)
+                kernels.addscaled((float*) accum, (float*) &accum[k * s->binstride], 1, (b+1)*2);
+            stats_end(&clock, STAT_MULTIPLY);
+
+            stats_begin(&clock);
+            fft_inverse(ss->plan, accum, ss->revspace);
+            stats_end(&clock, STAT_INVERSE);
+
+            // overlap-save: only the second half of the window is free of wraparound
+            stats_begin(&clock);
+            ringadd(pc, c, s->offset - b + latency, &ss->revspace[b], b);
+            stats_end(&clock, STAT_OVERLAP);
+        }
+        stats_fft(b*2, outch);
+
+        // slide the input windows over by one block
+        for (int c = 0; c < inch; c++)
+            memcpy(&ss->inspace[c*b*2], &ss->inspace[c*b*2 + b], sizeof(float) * b);
+        ss->fill = 0;
+    }
+
+    // everything up to latency frames ahead is now complete
+    stats_begin(&clock);
+    ringdrain(pc, out, latency);
+    stats_end(&clock, STAT_OVERLAP);
+}
+
+// forward transform of one input channel of one block in the batch
+static void batchforward(void *ctx, int task, int worker) {
+    partconv *pc = ctx;
+    pcstage *s = &pc->filter->stages[0];
+    pcstagestate *ss = &pc->stages[0];
+    int b = s->blocksize;
+    int inch = pc->inchannels;
+    int k = task / inch;
+    int c = task % inch;
+    float *window = &pc->wspace[worker*b*2];
+    statclock clock;
+
+    stats_begin(&clock);
+
+    // the first half of the window is the previous block
+    if ( k == 0 ) {
+        memcpy(window, &ss->inspace[c*b*2], sizeof(float) * b);
+    } else {
+        const float *prev = &pc->batchin[(k-1)*b*inch];
+        for (int i = 0; i < b; i++)
+            window[i] = prev[i*inch + c];
+    }
+
+    const float *cur = &pc->batchin[k*b*inch];
+    for (int i = 0; i < b; i++)
+        window[b+i] = cur[i*inch + c];
+
+    int slot = (ss->fdlpos + 1 + k) % ss->slots;
+    fft_forward(pc->wplans[worker], window, &fdlof(s, ss, c)[slot * s->binstride]);
+    stats_end(&clock, STAT_FORWARD);
+    stats_fft(b*2, 1);
+}
+
+// spectral multiply and inverse transform of one output channel of one block in the batch
+static void batchinverse(void *ctx, int task, int worker) {
+    partconv *pc = ctx;
+    pcfilter *f = pc->filter;
+    pcstage *s = &f->stages[0];
+    pcstagestate *ss = &pc->stages[0];
+    int b = s->blocksize;
+    int outch = pc->outchannels;
+    int k = task / outch;
+    int c = task % outch;
+    fftcpx *accum = &pc->waccum[worker * s->binstride];
+    float *window = &pc->wspace[worker*b*2];
+
+    int slot = (ss->fdlpos + 1 + k) % ss->slots;
+    statclock clock;
+
+    stats_begin(&clock);
+    mac(f, s, accum, fdlof(s, ss, pc->inchannels == 1 ? 0 : c), slot, ss->slots, f->channels == 1 ? 0 : c, 0, s->parts);
+    stats_end(&clock, STAT_MULTIPLY);
+
+    stats_begin(&clock);
+    fft_inverse(pc->wplans[worker], accum, window);
+    stats_end(&clock, STAT_INVERSE);
+    stats_fft(b*2, 1);
+
+    stats_begin(&clock);
+    float *out = &pc->batchout[k*b*outch];
+    for (int i = 0; i < b; i++)
+        out[i*outch + c] = window[b+i];
+    stats_end(&clock, STAT_OVERLAP);
+}
+
+void partconv_process_batch(partconv *pc, const float *in, float *out, int nblocks) {
+    int latency = pc->filter->latency;
+
+    if ( pc->maxbatch == 1 ) {
+        for (int k = 0; k < nblocks; k++)
+            partconv_process(pc, &in[k*latency*pc->inchannels], &out[k*latency*pc->outchannels]);
+        return;
+    }
+
+    // a uniform filter's blocks are independent once their spectra are in
+    // the delay line, so every block of every phase can run at once
+    pcstage *s = &pc->filter->stages[0];
+    pcstagestate *ss = &pc->stages[0];
+    int b = s->blocksize;
+    int inch = pc->inchannels;
+
+    while ( nblocks > 0 ) {
+        int n = nblocks < pc->maxbatch ? nblocks : pc->maxbatch;
+
+        pc->batchin = in;
+        pc->batchout = out;
+        pc->nblocks = n;
+
+        pool_run(pc->workers, batchforward, pc, n * inch);
+        pool_run(pc->workers, batchinverse, pc, n * pc->outchannels);
+
+        // leave the state just as partconv_process would have
+        ss->fdlpos = (ss->fdlpos + n) % ss->slots;
+        const float *last = &in[(n-1)*b*inch];
+        for (int c = 0; c < inch; c++)
+            for (int i = 0; i < b; i++)
+                ss->inspace[c*b*2 + i] = last[i*inch + c];
+
+        in += n*b*inch;
+        out += n*b*pc->outchannels;
+        nblocks -= n;
+    }
+}
+
+void partconv_reset(partconv *pc) {
+    pcfilter *f = pc->filter;
+
+    for (int s = 0; s < f->nstages; s++) {
+        pcstagestate *ss = &pc->stages[s];
+        int n = f->stages[s].blocksize*2;
+
+        memset(ss->inspace, 0, sizeof(float) * n * pc->inchannels);
+        memset(ss->fdl, 0, sizeof(fftcpx) * f->stages[s].binstride * ss->slots * pc->inchannels);
+        ss->fdlpos = 0;
+        ss->fill = 0;
+    }
+
+    if ( pc->ring )
+        memset(pc->ring, 0, sizeof(float) * pc->ringlen * pc->outchannels);
+    pc->ringpos = 0;
+
+    if ( f->taps )
+        memset(pc->history, 0, sizeof(float) * ((size_t) f->length - 1 + f->latency) * pc->inchannels);
+}
+
+void partconv_free(partconv *pc) {
+    if ( pc == NULL )
+        return;
+
+    for (int s = 0; s < pc->filter->nstages; s++) {
+        pcstagestate *ss = &pc->stages[s];
+        fft_plan_free(ss->plan);
+        fft_free(ss->inspace);
+        fft_free(ss->fdl);
+        fft_free(ss->partials);
+        fft_free(ss->revspace);
+    }
+
+    if ( pc->maxbatch > 1 ) {
+        if ( pc->wplans )
+            for (int i = 0; i < pool_threads(pc->workers); i++)
+                fft_plan_free(pc->wplans[i]);
+        free(pc->wplans);
+        fft_free(pc->wspace);
+        fft_free(pc->waccum);
+    }
+
+    fft_free(pc->history);
+    fft_free(pc->firout);
+    free(pc->rows);
+    fft_free(pc->ring);
+    free(pc);
+}
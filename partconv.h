@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef __PARTCONV_H__
+#define __PARTCONV_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fft.h"
+#include "pool.h"
+
+#define PC_MAXSTAGES 16
+
+// how a filter's spectra are stored. the 16 bit formats halve the memory
+// and bandwidth the spectral multiply streams through, for some rounding
+// noise: each partition is scaled to its largest component, so the noise
+// follows the level of the impulse down its decay. convolute-bench -P
+// measures it on the output, about 74dB under the signal for float16 and
+// 56dB for bfloat16.
+#define PC_FLOAT32  0
+#define PC_FLOAT16  1
+#define PC_BFLOAT16 2
+
+// one run of equal partitions, each stored as the spectrum of a zero-padded
+// transform of twice the partition length
+typedef struct {
+    int blocksize;   // partition length in samples
+    int offset;      // position in the impulse response of the first partition
+    int parts;       // number of partitions
+    int chunkparts;  // partitions per chunk; chunks are multiplied independently and summed in order
+    int chunks;
+    int binstride;   // distance between consecutive spectra, in bins
+    fftcpx *spectra; // channels*parts spectra, already divided by the transform length
+    uint16_t *halves; // in place of spectra at 16 bits, each spectrum's re,im pairs divided by its scale
+    float *scales;   // per channel and partition, what its halves are multiplied back by
+} pcstage;
+
+// an impulse response cut into partitions. a uniform filter has a single
+// stage; a low latency filter starts with small partitions at the head and
+// moves to progressively larger ones for the tail. a direct filter has no
+// stages at all and is convolved in the time domain.
+typedef struct {
+    int latency;     // samples per partconv_process call, the first stage's blocksize
+    int length;      // length of the original impulse response, in frames
+    int channels;
+    int nstages;
+    int precision;   // one of the PC_ storage formats
+    pcstage stages[PC_MAXSTAGES];
+    float *taps;     // for a direct filter, per channel the impulse response reversed
+
+    void *map;       // when the spectra live in a mapped spectra file rather than fft_malloc'd memory
+    size_t maplen;
+} pcfilter;
+
+typedef struct {
+    fftplan *plan;
+    float *inspace;  // per input channel, the last 2*blocksize input samples
+    fftcpx *fdl;     // per input channel, a frequency-domain delay line of the last input spectra
+    int slots;       // spectra per input channel in fdl, at least parts
+    int fdlpos;      // slot in fdl of the most recent input spectrum
+    fftcpx *partials; // per output channel, one partial spectrum sum per chunk
+    float *revspace; // output of the inverse transform
+    int fill;        // input frames gathered towards the next transform
+} pcstagestate;
+
+// partitioned overlap-save convolution against a pcfilter. every call
+// consumes latency interleaved input frames and produces the next latency
+// interleaved output frames, with no additional delay.
+//
+// channels pair up one to one, or a mono side is shared by every channel of
+// the other. each input channel is transformed once per block no matter how
+// many impulse channels it is multiplied against.
+typedef struct {
+    pcfilter *filter;
+    int inchannels;
+    int outchannels;
+    pcstagestate stages[PC_MAXSTAGES];
+    float *ring;     // per output channel, an accumulator stages add their blocks into ahead of ringpos
+    int ringlen;     // a power of two
+    int ringmask;
+    int ringpos;
+    float **rows;    // per output channel, where the next frames to hand out start
+
+    pool *workers;
+
+    // for a direct filter
+    float *history;  // per input channel, length-1 frames before the current block and the block itself
+    float *firout;   // per output channel, one block
+
+    // for partconv_process_batch on a uniform filter
+    int maxbatch;
+    fftplan **wplans;  // per worker, kissfft plans carry scratch space
+    float *wspace;     // per worker, a transform window
+    fftcpx *waccum;    // per worker, a spectrum accumulator
+    const float *batchin;
+    float *batchout;
+    int nblocks;
+} partconv;
+
+// uniform partitions of blocksize frames, ir is interleaved, spectra stored
+// at one of the PC_ precisions. these and partconv_new return NULL if out
+// of memory.
+pcfilter * pcfilter_new(const float *ir, int irlen, int channels, int blocksize, int precision);
+
+// partitions from latency frames up to at most maxblock frames
+pcfilter * pcfilter_new_lowlatency(const float *ir, int irlen, int channels, int latency, int maxblock, int precision);
+
+// blocksize frames at a time straight from the impulse response, with no
+// transforms. only worth it for short ones, see planner.h.
+pcfilter * pcfilter_new_direct(const float *ir, int irlen, int channels, int blocksize);
+
+void pcfilter_free(pcfilter *f);
+
+// bytes a stored bin takes at a precision
+size_t pcfilter_binbytes(int precision);
+
+// bytes of a stage's stored spectra, with their scales at 16 bits
+size_t pcfilter_stagebytes(const pcfilter *f, const pcstage *s);
+
+// returns the number of output channels for the given channel counts, or 0 if they can't be paired
+int partconv_outchannels(int inchannels, int irchannels);
+
+// also NULL if the channel counts can't be paired. workers may be NULL;
+// otherwise partconv_process_batch spreads the blocks of a uniform filter
+// over them, and the chunks of low latency stages are multiplied
+// concurrently. neither changes the output by a single bit.
+partconv * partconv_new(pcfilter *f, int inchannels, pool *workers);
+
+void partconv_process(partconv *pc, const float *in, float *out);
+
+// the same as nblocks calls to partconv_process
+void partconv_process_batch(partconv *pc, const float *in, float *out, int nblocks);
+
+// back to the state partconv_new left it in, as if all input so far was silence
+void partconv_reset(partconv *pc);
+void partconv_free(partconv *pc);
+
+#endif
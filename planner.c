@@ -0,0 +1,478 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+
+#include "fft.h"
+#include "kernels.h"
+#include "partconv.h"
+#include "planner.h"
+
+// partition sizes considered: multiples of 8, so the 4-lane kissfft takes
+// them too, of powers of two times 1, 3, 5, 9 or 15. that's five sizes an
+// octave, all with radices every backend has fast paths for.
+#define PLANNER_MINBLOCK 1024
+#define PLANNER_MAXBLOCK 262144
+#define PLANNER_MAXCANDIDATES 64
+
+// how many of the best estimates are timed, at measure and patient effort
+#define PLANNER_MEASURE 3
+#define PLANNER_PATIENT 6
+
+// the most memory a timed multiply-accumulate streams through
+#define PLANNER_MACBYTES (32 << 20)
+
+// an unknown input is costed per this many frames of output
+#define PLANNER_RATE 48000
+
+// direct convolution is only considered for impulses up to this long, and
+// runs in blocks of this many frames when there's no latency to meet
+#define PLANNER_MAXTAPS 4096
+#define PLANNER_DIRECTBLOCK 1024
+
+typedef struct {
+    int blocksize;
+    double fft;     // seconds per transform of 2*blocksize
+    double mac;     // seconds per bin of multiply-accumulate
+    double seconds;
+    size_t memory;
+    int measured;
+} candidate;
+
+static size_t l2size, llcsize;
+
+static size_t readcache(int index, int *level) {
+    char path[128], buf[32];
+    FILE *f;
+    size_t size = 0;
+
+    *level = 0;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", index);
+    if ( (f = fopen(path, "r")) == NULL )
+        return 0;
+    if ( fgets(buf, sizeof(buf), f) )
+        *level = atoi(buf);
+    fclose(f);
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+    if ( (f = fopen(path, "r")) == NULL )
+        return 0;
+    if ( fgets(buf, sizeof(buf), f) ) {
+        size = strtoul(buf, NULL, 10);
+        if ( strchr(buf, 'K') )
+            size <<= 10;
+        else if ( strchr(buf, 'M') )
+            size <<= 20;
+    }
+    fclose(f);
+
+    return size;
+}
+
+// from sysfs where there is one, otherwise sizes typical of the last decade
+static void findcaches(void) {
+    if ( llcsize )
+        return;
+
+    l2size = 256 << 10;
+    llcsize = 8 << 20;
+
+    for (int i = 0; i < 8; i++) {
+        int level;
+        size_t size = readcache(i, &level);
+        if ( level == 2 && size )
+            l2size = size;
+        if ( level >= 2 && size )
+            llcsize = size;
+    }
+}
+
+static int candidatesize(int n) {
+    if ( n % 8 )
+        return 0;
+    while ( n % 2 == 0 )
+        n /= 2;
+    return n == 1 || n == 3 || n == 5 || n == 9 || n == 15;
+}
+
+// seconds per element of a transform of n, relative to n log2 n, for the
+// backend built in. non power of two radices cost a little more, and so does
+// every cache level a transform outgrows.
+static double estimatefft(int n) {
+    const char *backend = fft_backend();
+    double k = strcmp(backend, "fftw3") == 0 ? 0.3e-9 : strcmp(backend, "kissfft-simd") == 0 ? 0.5e-9 : 1.2e-9;
+
+    if ( n % 5 == 0 )
+        k *= 1.25;
+    else if ( n % 3 == 0 )
+        k *= 1.15;
+
+    size_t bytes = (size_t) n * 2 * sizeof(float);
+    if ( bytes > llcsize )
+        k *= 2.5;
+    else if ( bytes > l2size )
+        k *= 1.4;
+
+    return k * n * log2(n);
+}
+
+// seconds per bin of multiply-accumulate for the kernels in use, or as
+// limited by memory bandwidth once the spectra no longer fit in cache
+static double estimatemac(size_t streamed) {
+    const char *name = kernels_name();
+    double perbin = strcmp(name, "avx512") == 0 ? 0.35e-9 : strcmp(name, "avx2") == 0 ? 0.45e-9 :
+                    strcmp(name, "sse2") == 0 ? 0.8e-9 : 1.6e-9;
+
+    // two spectra of 8 bytes a bin at some 10GB/s
+    if ( streamed > llcsize && perbin < 1.6e-9 )
+        perbin = 1.6e-9;
+
+    return perbin;
+}
+
+// seconds per tap per output frame of the fir kernel in use. the scalar one
+// is bound by the latency of its one running sum.
+static double estimatefir(void) {
+    const char *name = kernels_name();
+    return strcmp(name, "avx512") == 0 ? 0.02e-9 : strcmp(name, "avx2") == 0 ? 0.04e-9 :
+           strcmp(name, "sse2") == 0 || strcmp(name, "neon") == 0 ? 0.1e-9 : 1.2e-9;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// the best of a few runs of a forward and inverse transform pair
+static int measurefft(int n, double *seconds) {
+    fftplan *p = fft_plan(n);
+    float *time = fft_malloc(sizeof(float) * n);
+    fftcpx *bins = fft_malloc(sizeof(fftcpx) * fft_binstride(n));
+    int ok = p && time && bins;
+
+    if ( ok ) {
+        for (int i = 0; i < n; i++)
+            time[i] = (i * 7919 % 1000) / 1000.0f - 0.5f;
+
+        *seconds = INFINITY;
+        double until = now() + 0.02;
+        for (int rep = 0; rep < 3 || (rep < 50 && now() < until); rep++) {
+            double start = now();
+            fft_forward(p, time, bins);
+            fft_inverse(p, bins, time);
+            double took = (now() - start) / 2;
+            if ( took < *seconds )
+                *seconds = took;
+        }
+    }
+
+    fft_plan_free(p);
+    fft_free(time);
+    fft_free(bins);
+    return ok;
+}
+
+// multiply-accumulates of parts partitions, over as much memory as the real
+// ones would stream through up to a limit
+static int measuremac(int blocksize, int parts, double *perbin) {
+    int stride = fft_binstride(blocksize*2);
+    size_t bytes = (size_t) stride * sizeof(fftcpx) * 2;
+    int n = PLANNER_MACBYTES / bytes;
+
+    if ( n > parts )
+        n = parts;
+    if ( n < 1 )
+        n = 1;
+
+    fftcpx *x = fft_malloc(bytes/2 * n);
+    fftcpx *h = fft_malloc(bytes/2 * n);
+    fftcpx *acc = fft_malloc(sizeof(fftcpx) * stride);
+    int ok = x && h && acc;
+
+    if ( ok ) {
+        memset(x, 0, bytes/2 * n);
+        memset(h, 0, bytes/2 * n);
+        memset(acc, 0, sizeof(fftcpx) * stride);
+
+        *perbin = INFINITY;
+        for (int rep = 0; rep < 3; rep++) {
+            double start = now();
+            for (int k = 0; k < n; k++)
+                kernels.cmac(acc, &x[k*stride], &h[k*stride], blocksize+1);
+            double took = (now() - start) / ((double) n * (blocksize+1));
+            if ( took < *perbin )
+                *perbin = took;
+        }
+    }
+
+    fft_free(x);
+    fft_free(h);
+    fft_free(acc);
+    return ok;
+}
+
+// a block of direct convolution against the actual number of taps
+static int measurefir(int taps, double *pertap) {
+    int n = PLANNER_DIRECTBLOCK;
+    float *x = fft_malloc(sizeof(float) * (taps - 1 + n));
+    float *h = fft_malloc(sizeof(float) * taps);
+    float *out = fft_malloc(sizeof(float) * n);
+    int ok = x && h && out;
+
+    if ( ok ) {
+        for (int i = 0; i < taps - 1 + n; i++)
+            x[i] = (i * 7919 % 1000) / 1000.0f - 0.5f;
+        for (int k = 0; k < taps; k++)
+            h[k] = 1.0f / (k+1);
+
+        *pertap = INFINITY;
+        for (int rep = 0; rep < 3; rep++) {
+            double start = now();
+            kernels.fir(out, x, h, taps, n);
+            double took = (now() - start) / ((double) taps * n);
+            if ( took < *pertap )
+                *pertap = took;
+        }
+    }
+
+    fft_free(x);
+    fft_free(h);
+    fft_free(out);
+    return ok;
+}
+
+static int partsof(const planinput *in, int blocksize) {
+    return (in->irlength + blocksize - 1) / blocksize;
+}
+
+static int inchannelsof(const planinput *in) {
+    return in->inchannels > 0 ? in->inchannels : in->irchannels;
+}
+
+static int outchannelsof(const planinput *in) {
+    int inch = inchannelsof(in);
+    return inch > in->irchannels ? inch : in->irchannels;
+}
+
+// what partconv_new and the filter will allocate, near enough
+static size_t memoryof(const planinput *in, int blocksize) {
+    size_t stride = fft_binstride(blocksize*2);
+    size_t parts = partsof(in, blocksize);
+    size_t slots = parts + (in->threads > 1 ? in->threads - 1 : 0);
+    int inch = inchannelsof(in), outch = outchannelsof(in);
+
+    return stride * (pcfilter_binbytes(in->precision) * parts * in->irchannels + sizeof(fftcpx) * (slots * inch + outch))
+         + (size_t) blocksize * sizeof(float) * (2*inch + 2*outch);
+}
+
+static double framesof(const planinput *in) {
+    return in->inlength > 0 ? (double) in->inlength + in->irlength : PLANNER_RATE;
+}
+
+// the time of the whole convolution: blocks of input frames, each one
+// transformed forward per input channel and back per output channel, with
+// every partition multiplied in between
+static void cost(const planinput *in, candidate *c) {
+    int b = c->blocksize;
+    int parts = partsof(in, b);
+    int inch = inchannelsof(in), outch = outchannelsof(in);
+    double blocks = ceil(framesof(in) / b);
+
+    double perblock = (inch + outch) * c->fft + (double) outch * parts * (b+1) * c->mac
+                    + (inch + 2*outch) * b * 0.3e-9;
+
+    c->seconds = blocks * perblock;
+}
+
+static int directblock(const planinput *in) {
+    return in->latency ? in->latency : PLANNER_DIRECTBLOCK;
+}
+
+// the reversed taps, the input history and a block of output
+static size_t directmemory(const planinput *in) {
+    size_t b = directblock(in);
+    return sizeof(float) * (in->irlength * in->irchannels + (in->irlength - 1 + b) * inchannelsof(in) + b * outchannelsof(in));
+}
+
+// every tap for every output frame, plus the same shuffling in and out the
+// partitioned filter does
+static double directcost(const planinput *in, double pertap) {
+    int inch = inchannelsof(in), outch = outchannelsof(in);
+    return framesof(in) * (outch * in->irlength * pertap + (inch + 2*outch) * 0.3e-9);
+}
+
+static void setdirect(const planinput *in, planchoice *out, double seconds) {
+    out->direct = 1;
+    out->blocksize = directblock(in);
+    out->parts = 1;
+    out->seconds = seconds;
+    out->memory = directmemory(in);
+}
+
+static int cheaper(const void *a, const void *b) {
+    const candidate *x = a, *y = b;
+    return (x->seconds > y->seconds) - (x->seconds < y->seconds);
+}
+
+void planner_choose(const planinput *in, planchoice *out) {
+    candidate cands[PLANNER_MAXCANDIDATES];
+    int n = 0;
+    int effort = in->effort;
+
+    findcaches();
+
+    memset(out, 0, sizeof(*out));
+    out->frames = in->inlength > 0 ? in->inlength + in->irlength : PLANNER_RATE;
+
+    if ( in->direct > 0 ) {
+        setdirect(in, out, directcost(in, estimatefir()));
+        return;
+    }
+
+    // no point in partitions much longer than the impulse itself
+    int longest = PLANNER_MAXBLOCK;
+    while ( longest/2 >= PLANNER_MINBLOCK && longest/2 >= in->irlength && longest/2 >= in->latency )
+        longest /= 2;
+
+    for (int b = PLANNER_MINBLOCK; b <= longest && n < PLANNER_MAXCANDIDATES; b += 8) {
+        if ( b < in->latency || !candidatesize(b) )
+            continue;
+
+        candidate *c = &cands[n++];
+        int parts = partsof(in, b);
+        c->blocksize = b;
+        c->fft = estimatefft(b*2);
+        c->mac = estimatemac((size_t) parts * fft_binstride(b*2) *
+                             (pcfilter_binbytes(in->precision) * in->irchannels + sizeof(fftcpx) * inchannelsof(in)));
+        c->memory = memoryof(in, b);
+        c->measured = 0;
+        cost(in, c);
+
+        // over the cap counts for nothing, unless nothing fits
+        if ( in->memcap && c->memory > in->memcap )
+            c->seconds = INFINITY;
+    }
+
+    if ( n == 0 ) {
+        // a latency beyond every candidate partitions at the latency
+        out->blocksize = in->latency;
+        out->parts = partsof(in, in->latency);
+        out->memory = memoryof(in, in->latency);
+        return;
+    }
+
+    qsort(cands, n, sizeof(candidate), cheaper);
+
+    // the model only has to get the best few right, those are timed
+    int timed = effort == FFT_PATIENT ? PLANNER_PATIENT : effort == FFT_MEASURE ? PLANNER_MEASURE : 0;
+    if ( timed > n )
+        timed = n;
+
+    int measured = 0;
+    for (int i = 0; i < timed; i++) {
+        candidate *c = &cands[i];
+        if ( isinf(c->seconds) )
+            break;
+        if ( measurefft(c->blocksize*2, &c->fft) && measuremac(c->blocksize, partsof(in, c->blocksize), &c->mac) ) {
+            c->measured = 1;
+            measured++;
+            cost(in, c);
+        }
+    }
+
+    if ( measured )
+        qsort(cands, measured, sizeof(candidate), cheaper);
+
+    // with nothing under the cap, the smallest is the best there is
+    candidate *best = &cands[0];
+    if ( isinf(best->seconds) ) {
+        for (int i = 1; i < n; i++)
+            if ( cands[i].memory < best->memory )
+                best = &cands[i];
+        best->seconds = 0;
+        cost(in, best);
+    }
+
+    out->blocksize = best->blocksize;
+    out->parts = partsof(in, best->blocksize);
+    out->seconds = best->seconds;
+    out->memory = best->memory;
+    out->candidates = n;
+    out->measured = measured;
+
+    // a short impulse can cost less slid over the input tap by tap. its
+    // cost grows with the taps, so where it meets the partitioned one is
+    // the crossover.
+    if ( in->direct == 0 && in->irlength <= PLANNER_MAXTAPS ) {
+        double pertap = estimatefir();
+        if ( effort != FFT_ESTIMATE && measurefir(in->irlength, &pertap) )
+            out->measured++;
+        out->candidates++;
+
+        double seconds = directcost(in, pertap), overhead = directcost(in, 0);
+        if ( out->seconds > overhead )
+            out->crossover = in->irlength * (out->seconds - overhead) / (seconds - overhead);
+
+        int fits = !in->memcap || directmemory(in) <= in->memcap || out->memory > in->memcap;
+        if ( seconds < out->seconds && fits )
+            setdirect(in, out, seconds);
+    }
+}
+
+int planner_swap(const planinput *in, planchoice *kept, planchoice *swapped) {
+    planinput other = *in;
+
+    other.irlength = in->inlength;
+    other.irchannels = inchannelsof(in);
+    other.inlength = in->irlength;
+    other.inchannels = in->irchannels;
+
+    planner_choose(in, kept);
+    planner_choose(&other, swapped);
+
+    // the partitioned side is held whole in memory, at most an int's worth of frames
+    if ( in->inlength > INT_MAX )
+        return 0;
+
+    if ( in->memcap && kept->memory > in->memcap && swapped->memory <= in->memcap )
+        return 1;
+    if ( in->memcap && swapped->memory > in->memcap && kept->memory <= in->memcap )
+        return 0;
+
+    return swapped->seconds < kept->seconds;
+}
+
+void planner_print(FILE *f, const char *what, const planchoice *c) {
+    if ( c->direct )
+        fprintf(f, "%s: direct in blocks of %d frames", what, c->blocksize);
+    else
+        fprintf(f, "%s: %d partitions of %d frames", what, c->parts, c->blocksize);
+
+    fprintf(f, ", predicted %.3fs for %lld frames and %.1fMB, best of %d sizes with %d timed",
+            c->seconds, (long long) c->frames, c->memory / 1048576.0, c->candidates, c->measured);
+    if ( c->crossover )
+        fprintf(f, ", direct below %d taps", c->crossover);
+    fputc('\n', f);
+}
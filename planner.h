@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+#ifndef __PLANNER_H__
+#define __PLANNER_H__
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// picks the partition size of a uniform filter by the time it predicts the
+// whole convolution will take. every candidate's cost comes from a model of
+// the fft backend and kernels in use, the cpu's cache sizes and the input
+// length; at FFT_MEASURE or FFT_PATIENT effort the best few are timed as
+// well, which can choose differently from one run to the next. a short enough impulse response is instead convolved
+// directly, when its taps cost less than the transforms would.
+typedef struct {
+    int64_t irlength;  // frames of the side that gets partitioned
+    int irchannels;
+    int64_t inlength;  // frames of the side streamed through, 0 if unknown
+    int inchannels;    // 0 if unknown
+    int latency;       // partitions can't be smaller than this
+    int threads;
+    size_t memcap;     // bytes the filter and its state may take, 0 for no limit
+    int direct;        // 1 forces a direct filter, -1 rules one out
+    int precision;     // the spectra's storage format, see partconv.h
+    int effort;        // FFT_ESTIMATE to go by the model alone
+} planinput;
+
+typedef struct {
+    int blocksize;
+    int parts;
+    int64_t frames;    // of output the prediction is for, a second's worth at 48kHz when the input length is unknown
+    double seconds;
+    size_t memory;     // predicted bytes of spectra and state
+    int candidates;    // sizes considered
+    int measured;      // of those, how many were timed
+    int direct;        // convolve in the time domain, blocksize frames at a time
+    int crossover;     // impulse length below which direct would win, 0 if not considered
+} planchoice;
+
+void planner_choose(const planinput *in, planchoice *out);
+
+// whether the impulse response is cheaper convolved through the input than
+// the other way around. fills in the choices for both ways. an input too
+// long to be partitioned is never swapped.
+int planner_swap(const planinput *in, planchoice *kept, planchoice *swapped);
+
+void planner_print(FILE *f, const char *what, const planchoice *c);
+
+#endif
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "die.h"
+#include "pool.h"
+
+struct pool {
+    int threads;
+    pthread_t *tids;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;  // signalled when a new batch starts or the pool shuts down
+    pthread_cond_t done;  // signalled when the last task of a batch finishes
+
+    pooltask fn;
+    void *ctx;
+    int ntasks;
+    int next;      // next task to hand out
+    int finished;  // tasks completed in this batch
+    int batch;     // incremented for each pool_run, so idle workers notice new work
+    int workers;   // worker indices handed out so far in this batch
+    int quit;
+};
+
+// take tasks from the current batch until there are none left
+static void drain(pool *p, int worker) {
+    while ( p->next < p->ntasks ) {
+        int task = p->next++;
+        pthread_mutex_unlock(&p->lock);
+
+        p->fn(p->ctx, task, worker);
+
+        pthread_mutex_lock(&p->lock);
+        if ( ++p->finished == p->ntasks )
+            pthread_cond_broadcast(&p->done);
+    }
+}
+
+static void * workerthread(void *arg) {
+    pool *p = arg;
+    int seen = 0;
+
+    pthread_mutex_lock(&p->lock);
+    while ( 1 ) {
+        while ( !p->quit && p->batch == seen )
+            pthread_cond_wait(&p->work, &p->lock);
+        if ( p->quit )
+            break;
+        seen = p->batch;
+
+        drain(p, p->workers++);
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+pool * pool_new(int threads) {
+    pool *p;
+
+    if ( (p = malloc(sizeof(*p))) == NULL )
+        return NULL;
+
+    if ( threads < 1 )
+        threads = 1;
+
+    p->threads = 1;
+    p->ntasks = p->next = p->finished = 0;
+    p->batch = 0;
+    p->workers = 0;
+    p->quit = 0;
+
+    if ( (p->tids = malloc(sizeof(pthread_t) * threads)) == NULL ) {
+        free(p);
+        return NULL;
+    }
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work, NULL);
+    pthread_cond_init(&p->done, NULL);
+
+    // the caller of pool_run is the first worker. threads counts the ones
+    // actually started, so pool_free joins just those after a failure.
+    for (int i = 1; i < threads; i++) {
+        if ( pthread_create(&p->tids[i], NULL, workerthread, p) ) {
+            pool_free(p);
+            return NULL;
+        }
+        p->threads++;
+    }
+
+    return p;
+}
+
+int pool_threads(pool *p) {
+    return p->threads;
+}
+
+void pool_run(pool *p, pooltask fn, void *ctx, int ntasks) {
+    if ( p->threads == 1 ) {
+        for (int i = 0; i < ntasks; i++)
+            fn(ctx, i, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&p->lock);
+
+    p->fn = fn;
+    p->ctx = ctx;
+    p->ntasks = ntasks;
+    p->next = 0;
+    p->finished = 0;
+    p->workers = 1;
+    p->batch++;
+    pthread_cond_broadcast(&p->work);
+
+    drain(p, 0);
+    while ( p->finished < p->ntasks )
+        pthread_cond_wait(&p->done, &p->lock);
+
+    pthread_mutex_unlock(&p->lock);
+}
+
+void pool_free(pool *p) {
+    pthread_mutex_lock(&p->lock);
+    p->quit = 1;
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->lock);
+
+    for (int i = 1; i < p->threads; i++)
+        pthread_join(p->tids[i], NULL);
+
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->work);
+    pthread_cond_destroy(&p->done);
+    free(p->tids);
+    free(p);
+}
+
+void spsc_init(spscqueue *q, int size) {
+    if ( (q->items = malloc(sizeof(void*) * size)) == NULL )
+        die("Couldn't malloc space for queue");
+
+    q->size = size;
+    q->head = 0;
+    q->tail = 0;
+
+    if ( sem_init(&q->filled, 0, 0) || sem_init(&q->free, 0, size) )
+        die("Couldn't create queue semaphores");
+}
+
+// the semaphores order the slot accesses: a slot is written before the post
+// that hands it over, and read only after the wait that receives it
+void spsc_push(spscqueue *q, void *item) {
+    while ( sem_wait(&q->free) )
+        ;
+
+    q->items[q->tail] = item;
+    q->tail = (q->tail + 1) % q->size;
+
+    sem_post(&q->filled);
+}
+
+void * spsc_pop(spscqueue *q) {
+    while ( sem_wait(&q->filled) )
+        ;
+
+    void *item = q->items[q->head];
+    q->head = (q->head + 1) % q->size;
+
+    sem_post(&q->free);
+
+    return item;
+}
+
+void spsc_destroy(spscqueue *q) {
+    sem_destroy(&q->filled);
+    sem_destroy(&q->free);
+    free(q->items);
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <pthread.h>
+#include <semaphore.h>
+
+// a fixed set of worker threads that run batches of independent tasks.
+// the thread calling pool_run works through tasks too, so a pool of one
+// thread never starts any others.
+typedef struct pool pool;
+
+typedef void (*pooltask)(void *ctx, int task, int worker);
+
+// NULL if memory or threads run out
+pool * pool_new(int threads);
+int pool_threads(pool *p);
+
+// runs fn(ctx, task, worker) for every task in [0,ntasks), returns when all
+// of them are done. worker is in [0,pool_threads) and unique among the tasks
+// running at any one time, for indexing per-worker scratch space.
+void pool_run(pool *p, pooltask fn, void *ctx, int ntasks);
+
+void pool_free(pool *p);
+
+// a bounded fifo of pointers from exactly one thread to exactly one other,
+// for handing buffers along. neither side ever takes a lock: each owns its
+// end of the ring, and the semaphores only put a side to sleep when the
+// queue is full or empty.
+typedef struct {
+    void **items;
+    int size;
+    int head;    // next slot to pop, only touched by the consumer
+    int tail;    // next slot to push, only touched by the producer
+    sem_t filled;
+    sem_t free;
+} spscqueue;
+
+void spsc_init(spscqueue *q, int size);
+void spsc_push(spscqueue *q, void *item);
+void * spsc_pop(spscqueue *q);
+void spsc_destroy(spscqueue *q);
+
+#endif
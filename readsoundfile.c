@@ -15,107 +15,100 @@
  */
 
 #include "readsoundfile.h"
-#include "die.h"
-
-#include <sndfile.h>
+#include "soundin.h"
 
+#include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
-soundfile * readsoundfile(char *path) {
-    soundfile * ret;
-    SF_INFO info;
-    SNDFILE *snd;
-
-    memset(&info, 0, sizeof(info));
-
-    if ( (snd = sf_open(path, SFM_READ, &info)) == NULL )
-        diem("Couldn't open sound file for reading", path);
-
-    if ( info.channels != 1 )
-        diem("Sound file has more than one channel", path);
-
-    if ( (ret = malloc(sizeof(*ret))) == NULL )
-        die("Couldn't malloc space for soundfile");
-
-    if ( (ret->data = malloc(sizeof(float)*info.frames)) == NULL )
-        die("Couldn't malloc space for sound buffer");
-
-    sf_read_float(snd, ret->data, info.frames); // assumption: channel count is 1, verified above
-
-    ret->length = info.frames;
-    ret->samplerate = info.samplerate;
-
-    if ( sf_close(snd) )
-        diem("Couldn't close sound file", path);
-
-    return ret;
+soundfile * readsoundfile(const char *path) {
+    return readsoundfilechunk(path, 0, -1);
 }
 
-soundfile * readsoundfilechunk(char *path, int start, int len) {
+soundfile * readsoundfilechunk(const char *path, int64_t start, int64_t len) {
     soundfile * ret;
-    SF_INFO info;
-    SNDFILE *snd;
-
-    memset(&info, 0, sizeof(info));
-
-    if ( (snd = sf_open(path, SFM_READ, &info)) == NULL )
-        diem("Couldn't open sound file for reading", path);
+    soundin *in;
+
+    if ( (in = soundin_open(path)) == NULL )
+        return NULL;
+
+    if ( len < 0 )
+        len = soundin_frames(in);
+
+    if ( (ret = malloc(sizeof(*ret))) == NULL ) {
+        soundin_close(in);
+        return NULL;
+    }
+
+    // never malloc(0), so an empty file isn't taken for running out of memory
+    if ( (ret->data = malloc(sizeof(float)*len*soundin_channels(in) + 1)) == NULL ) {
+        free(ret);
+        soundin_close(in);
+        return NULL;
+    }
+
+    if ( start )
+        soundin_seek(in, start);
+
+    // soundin_read takes an int's worth of frames at a time
+    ret->length = 0;
+    while ( ret->length < len ) {
+        int want = len - ret->length < INT_MAX ? len - ret->length : INT_MAX;
+        int got = soundin_read(in, &ret->data[ret->length * soundin_channels(in)], want);
+        ret->length += got;
+        if ( got < want )
+            break;
+    }
+    ret->channels = soundin_channels(in);
+    ret->samplerate = soundin_samplerate(in);
+
+    soundin_close(in);
 
-    if ( info.channels != 1 )
-        diem("Sound file has more than one channel", path);
+    return ret;
+}
 
-    if ( (ret = malloc(sizeof(*ret))) == NULL )
-        die("Couldn't malloc space for soundfile");
+void soundfile_free(soundfile *s) {
+    if ( s == NULL )
+        return;
+    free(s->data);
+    free(s);
+}
 
-    if ( (ret->data = malloc(sizeof(float)*len)) == NULL )
-        die("Couldn't malloc space for sound buffer");
+int64_t getsoundfilelength(const char *path) {
+    soundin *in;
 
-    sf_seek(snd, start, SEEK_SET);
-    int actuallen = sf_read_float(snd, ret->data, len); // assumption: channel count is 1, verified above
+    if ( (in = soundin_open(path)) == NULL )
+        return -1;
 
-    ret->length = actuallen;
-    ret->samplerate = info.samplerate;
+    int64_t ret = soundin_frames(in);
 
-    if ( sf_close(snd) )
-        diem("Couldn't close sound file", path);
+    soundin_close(in);
 
     return ret;
 }
 
-int getsoundfilelength(char *path) {
-    SF_INFO info;
-    SNDFILE *snd;
-
-    memset(&info, 0, sizeof(info));
-
-    if ( (snd = sf_open(path, SFM_READ, &info)) == NULL )
-        diem("Couldn't open a sound file for reading", path);
+int getsoundfilechannels(const char *path) {
+    soundin *in;
 
-    if ( info.channels != 1 )
-        diem("A sound file has more than one channel", path);
+    if ( (in = soundin_open(path)) == NULL )
+        return -1;
 
-    int ret = info.frames;
+    int ret = soundin_channels(in);
 
-    if ( sf_close(snd) )
-        diem("Couldn't close sound file", path);
+    soundin_close(in);
 
     return ret;
 }
 
-int getsoundfilesamplerate(char *path) {
-    SF_INFO info;
-    SNDFILE *snd;
+int getsoundfilesamplerate(const char *path) {
+    soundin *in;
 
-    memset(&info, 0, sizeof(info));
+    if ( (in = soundin_open(path)) == NULL )
+        return -1;
 
-    if ( (snd = sf_open(path, SFM_READ, &info)) == NULL )
-        diem("Couldn't open a sound file for reading", path);
+    int ret = soundin_samplerate(in);
 
-    int ret = info.samplerate;
-
-    if ( sf_close(snd) )
-        diem("Couldn't close sound file", path);
+    soundin_close(in);
 
     return ret;
 }
-
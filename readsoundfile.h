@@ -17,16 +17,22 @@
 #ifndef __READSOUNDFILE_H__
 #define __READSOUNDFILE_H__
 
+#include <stdint.h>
+
 typedef struct {
-    float *data;
-    int length;
+    float *data;    // interleaved
+    int64_t length; // in frames
+    int channels;
     int samplerate;
 } soundfile;
 
-soundfile * readsoundfile(char *path);
-soundfile * readsoundfilechunk(char *path, int start, int len);
-int getsoundfilesamplerate(char *path);
-int getsoundfilelength(char *path);
+// these return NULL or -1 if the file can't be opened or memory runs out
+soundfile * readsoundfile(const char *path);
+soundfile * readsoundfilechunk(const char *path, int64_t start, int64_t len);
+void soundfile_free(soundfile *s);
+int getsoundfilesamplerate(const char *path);
+int64_t getsoundfilelength(const char *path);
+int getsoundfilechannels(const char *path);
 
 #endif
 
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "kernels.h"
+#include "resample.h"
+
+// zero crossings of the sinc kept on either side of its peak
+#define RESAMPLE_ZEROS 32
+
+// the cutoff as a fraction of the lower nyquist frequency, leaving the
+// window's transition band room to roll off before it
+#define RESAMPLE_ROLLOFF 0.95
+
+// the kaiser window's shape, about 90dB down in the stopband
+#define RESAMPLE_BETA 9.0
+
+#define RESAMPLE_PI 3.14159265358979323846
+
+// coefficients in a filter bank, beyond which the ratio is refused
+#define RESAMPLE_MAXBANK (1 << 26)
+
+struct resampler {
+    int up, down;   // output frame j sits at input frame j*down/up, in lowest terms
+    int half;       // taps on either side of an output's position
+    int taps;       // per phase, 2*half
+    float *bank;    // up phases of taps coefficients, one phase per fractional position
+};
+
+static int gcd(int a, int b) {
+    while ( b ) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// the zeroth order modified bessel function, for the window
+static double bessel0(double x) {
+    double sum = 1, term = 1;
+    for (int k = 1; k < 64 && term > sum * 1e-17; k++) {
+        term *= (x / (2*k)) * (x / (2*k));
+        sum += term;
+    }
+    return sum;
+}
+
+resampler * resampler_new(int inrate, int outrate) {
+    resampler *r;
+
+    if ( inrate < 1 || outrate < 1 )
+        return NULL;
+    if ( (r = malloc(sizeof(*r))) == NULL )
+        return NULL;
+
+    int g = gcd(inrate, outrate);
+    r->up = outrate / g;
+    r->down = inrate / g;
+
+    // going down, the sinc widens with the lower cutoff
+    double cutoff = RESAMPLE_ROLLOFF * (r->up < r->down ? (double) r->up / r->down : 1);
+    r->half = ceil(RESAMPLE_ZEROS / cutoff);
+    r->taps = 2 * r->half;
+
+    if ( (size_t) r->up * r->taps > RESAMPLE_MAXBANK ||
+         (r->bank = malloc(sizeof(float) * r->up * r->taps)) == NULL ) {
+        free(r);
+        return NULL;
+    }
+
+    // phase p is for outputs p/up of the way from one input frame to the
+    // next, and its taps run over the input frames from half-1 before that
+    // one to half after
+    double norm = bessel0(RESAMPLE_BETA);
+    for (int p = 0; p < r->up; p++) {
+        for (int k = 0; k < r->taps; k++) {
+            double t = (double) p / r->up + r->half - 1 - k;
+            double x = t / r->half, s = cutoff * t;
+            double sinc = s == 0 ? 1 : sin(RESAMPLE_PI * s) / (RESAMPLE_PI * s);
+            double window = fabs(x) < 1 ? bessel0(RESAMPLE_BETA * sqrt(1 - x*x)) / norm : 0;
+            r->bank[(size_t) p * r->taps + k] = cutoff * sinc * window;
+        }
+    }
+
+    return r;
+}
+
+int64_t resampler_outframes(const resampler *r, int64_t inframes) {
+    return (inframes * r->up + r->down - 1) / r->down;
+}
+
+int resampler_run(const resampler *r, const float *in, int64_t frames, int channels, float *out) {
+    int64_t outframes = resampler_outframes(r, frames);
+    float *x;
+
+    // a channel at a time, with half frames of silence either side so the
+    // taps never run off the ends
+    if ( (x = calloc(frames + r->taps, sizeof(float))) == NULL )
+        return -1;
+
+    for (int c = 0; c < channels; c++) {
+        for (int64_t i = 0; i < frames; i++)
+            x[r->half + i] = in[i*channels + c];
+
+        int64_t at = 0;
+        int p = 0;
+        for (int64_t j = 0; j < outframes; j++) {
+            out[j*channels + c] = kernels.dot(&x[at+1], &r->bank[(size_t) p * r->taps], r->taps);
+
+            at += r->down / r->up;
+            p += r->down % r->up;
+            if ( p >= r->up ) {
+                p -= r->up;
+                at++;
+            }
+        }
+    }
+
+    free(x);
+    return 0;
+}
+
+void resampler_free(resampler *r) {
+    if ( r == NULL )
+        return;
+    free(r->bank);
+    free(r);
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+#ifndef __RESAMPLE_H__
+#define __RESAMPLE_H__
+
+#include <stdint.h>
+
+// polyphase resampling by the rational ratio of two sample rates, through a
+// kaiser windowed sinc. the cutoff sits just under the lower of the two
+// nyquist frequencies, so a downsampled signal doesn't alias. amplitude is
+// kept: a sine comes out at the level it went in at.
+typedef struct resampler resampler;
+
+// NULL if the ratio's filter bank doesn't fit in memory
+resampler * resampler_new(int inrate, int outrate);
+
+// frames out of a whole input of the given length
+int64_t resampler_outframes(const resampler *r, int64_t inframes);
+
+// resamples all of an interleaved input of frames frames into out, which
+// takes resampler_outframes of them. returns -1 if out of memory.
+int resampler_run(const resampler *r, const float *in, int64_t frames, int channels, float *out);
+
+void resampler_free(resampler *r);
+
+#endif
@@ -0,0 +1,323 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <sndfile.h>
+
+#include "soundin.h"
+
+// sample encodings converted straight from a mapping
+enum { ENC_U8, ENC_S16, ENC_S24, ENC_S32, ENC_F32, ENC_F64 };
+
+struct soundin {
+    int64_t frames;
+    int64_t pos;
+    int channels;
+    int samplerate;
+    int samplebytes;
+
+    // mapped: the pcm payload and how it's encoded
+    void *map;
+    size_t maplen;
+    const unsigned char *data;
+    int encoding;
+
+    // otherwise
+    SNDFILE *snd;
+};
+
+static uint32_t get16(const unsigned char *p) {
+    return p[0] | (uint32_t) p[1] << 8;
+}
+
+static uint32_t get32(const unsigned char *p) {
+    return get16(p) | get16(&p[2]) << 16;
+}
+
+static uint64_t get64(const unsigned char *p) {
+    return get32(p) | (uint64_t) get32(&p[4]) << 32;
+}
+
+// bytes per sample of a libsndfile format
+static int samplebytes(int format) {
+    switch ( format & SF_FORMAT_SUBMASK ) {
+        case SF_FORMAT_PCM_S8:
+        case SF_FORMAT_PCM_U8: return 1;
+        case SF_FORMAT_PCM_16: return 2;
+        case SF_FORMAT_PCM_24: return 3;
+        case SF_FORMAT_DOUBLE: return 8;
+    }
+    return 4;
+}
+
+// finds the format and payload of a wav or rf64 file. returns -1 for
+// anything the mapping can't convert, which libsndfile then gets a go at.
+static int parsewav(soundin *s, const unsigned char *m, size_t len) {
+    size_t at = 12, datalen = 0;
+    uint64_t ds64data = 0;
+    int tag = 0, bits = 0;
+
+    if ( len < 12 || (memcmp(m, "RIFF", 4) && memcmp(m, "RF64", 4)) || memcmp(&m[8], "WAVE", 4) )
+        return -1;
+
+    while ( s->data == NULL && at + 8 <= len ) {
+        size_t size = get32(&m[at+4]);
+        const unsigned char *c = &m[at+8];
+
+        // an rf64 keeps the 64 bit size of its data up front, and leaves
+        // the data chunk's own size at its maximum
+        if ( memcmp(&m[at], "ds64", 4) == 0 && size >= 24 && at + 8 + size <= len )
+            ds64data = get64(&c[8]);
+        else if ( memcmp(&m[at], "data", 4) == 0 && size == UINT32_MAX && ds64data )
+            size = ds64data;
+
+        if ( memcmp(&m[at], "fmt ", 4) == 0 && size >= 16 && at + 8 + size <= len ) {
+            tag = get16(c);
+            s->channels = get16(&c[2]);
+            s->samplerate = get32(&c[4]);
+            bits = get16(&c[14]);
+            // extensible formats keep the real tag at the start of the subformat guid
+            if ( tag == 0xfffe && size >= 26 )
+                tag = get16(&c[24]);
+        } else if ( memcmp(&m[at], "data", 4) == 0 ) {
+            // a stream's writer may have left the size at its maximum
+            datalen = size < len - at - 8 ? size : len - at - 8;
+            s->data = c;
+        }
+
+        at += 8 + size + (size & 1);
+    }
+
+    if ( s->data == NULL || s->channels < 1 || s->samplerate < 1 )
+        return -1;
+
+    if ( tag == 1 && bits == 8 )
+        s->encoding = ENC_U8;
+    else if ( tag == 1 && bits == 16 )
+        s->encoding = ENC_S16;
+    else if ( tag == 1 && bits == 24 )
+        s->encoding = ENC_S24;
+    else if ( tag == 1 && bits == 32 )
+        s->encoding = ENC_S32;
+    else if ( tag == 3 && bits == 32 )
+        s->encoding = ENC_F32;
+    else if ( tag == 3 && bits == 64 )
+        s->encoding = ENC_F64;
+    else
+        return -1;
+
+    s->samplebytes = bits / 8;
+    s->frames = datalen / ((size_t) s->samplebytes * s->channels);
+
+    return 0;
+}
+
+// maps a regular file and finds its payload. returns -1 to fall back to libsndfile.
+static int openmapped(soundin *s, int fd, int rawchannels) {
+    struct stat st;
+    const char *want = getenv("CONVOLUTE_IO");
+
+    if ( want && strcmp(want, "sndfile") == 0 )
+        return -1;
+    if ( fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size == 0 )
+        return -1;
+
+    s->maplen = st.st_size;
+    if ( (s->map = mmap(NULL, s->maplen, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED ) {
+        s->map = NULL;
+        return -1;
+    }
+    posix_madvise(s->map, s->maplen, POSIX_MADV_SEQUENTIAL);
+
+    if ( rawchannels ) {
+        s->data = s->map;
+        s->encoding = ENC_F32;
+        s->samplebytes = 4;
+        s->channels = rawchannels;
+        s->samplerate = 0;
+        s->frames = s->maplen / (4 * (size_t) rawchannels);
+        return 0;
+    }
+
+    if ( parsewav(s, s->map, s->maplen) ) {
+        munmap(s->map, s->maplen);
+        s->map = NULL;
+        s->data = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static soundin * openfile(const char *path, int rawchannels) {
+    int stdinput = strcmp(path, "-") == 0;
+    soundin *s;
+    int fd;
+
+    if ( (s = calloc(1, sizeof(*s))) == NULL )
+        return NULL;
+
+    if ( (fd = stdinput ? STDIN_FILENO : open(path, O_RDONLY)) < 0 ) {
+        free(s);
+        return NULL;
+    }
+
+    // either way it's read front to back, once. pipes just say no.
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    if ( !stdinput && openmapped(s, fd, rawchannels) == 0 ) {
+        // the mapping holds its own reference to the file
+        close(fd);
+        return s;
+    }
+
+    SF_INFO info;
+    memset(&info, 0, sizeof(info));
+    if ( rawchannels ) {
+        // libsndfile wants a rate even for raw samples; it isn't reported
+        info.format = SF_FORMAT_RAW | SF_FORMAT_FLOAT | SF_ENDIAN_LITTLE;
+        info.channels = rawchannels;
+        info.samplerate = 48000;
+    }
+
+    if ( (s->snd = sf_open_fd(fd, SFM_READ, &info, !stdinput)) == NULL ) {
+        if ( !stdinput )
+            close(fd);
+        free(s);
+        return NULL;
+    }
+
+    s->frames = stdinput ? -1 : info.frames;
+    s->channels = info.channels;
+    s->samplerate = rawchannels ? 0 : info.samplerate;
+    s->samplebytes = samplebytes(info.format);
+
+    return s;
+}
+
+soundin * soundin_open(const char *path) {
+    return openfile(path, 0);
+}
+
+soundin * soundin_open_raw(const char *path, int channels) {
+    return channels > 0 ? openfile(path, channels) : NULL;
+}
+
+int64_t soundin_frames(const soundin *s) {
+    return s->frames;
+}
+
+int soundin_channels(const soundin *s) {
+    return s->channels;
+}
+
+int soundin_samplerate(const soundin *s) {
+    return s->samplerate;
+}
+
+int soundin_samplebytes(const soundin *s) {
+    return s->samplebytes;
+}
+
+const char * soundin_backend(const soundin *s) {
+    return s->map ? "mmap" : "sndfile";
+}
+
+// to floats the way libsndfile would, so the two backends agree to the bit
+static void convert(float *dst, const unsigned char *p, size_t n, int encoding) {
+    switch ( encoding ) {
+        case ENC_U8:
+            for (size_t i = 0; i < n; i++)
+                dst[i] = ((int) p[i] - 128) * (1.0f / 128);
+            break;
+        case ENC_S16:
+            for (size_t i = 0; i < n; i++, p += 2)
+                dst[i] = (int16_t) get16(p) * (1.0f / 32768);
+            break;
+        case ENC_S24:
+            for (size_t i = 0; i < n; i++, p += 3)
+                dst[i] = ((int32_t) ((uint32_t) p[0] << 8 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 24) >> 8) * (1.0f / 8388608);
+            break;
+        case ENC_S32:
+            for (size_t i = 0; i < n; i++, p += 4)
+                dst[i] = (int32_t) get32(p) * (1.0f / 2147483648.0f);
+            break;
+        case ENC_F32:
+            for (size_t i = 0; i < n; i++, p += 4) {
+                uint32_t v = get32(p);
+                memcpy(&dst[i], &v, sizeof(float));
+            }
+            break;
+        case ENC_F64:
+            for (size_t i = 0; i < n; i++, p += 8) {
+                uint64_t v = get64(p);
+                double d;
+                memcpy(&d, &v, sizeof(double));
+                dst[i] = d;
+            }
+            break;
+    }
+}
+
+int soundin_read(soundin *s, float *buf, int frames) {
+    int got = 0, n;
+
+    if ( s->map ) {
+        if ( frames > s->frames - s->pos )
+            frames = s->frames - s->pos;
+        size_t at = (size_t) s->pos * s->channels * s->samplebytes;
+        convert(buf, &s->data[at], (size_t) frames * s->channels, s->encoding);
+        s->pos += frames;
+        return frames;
+    }
+
+    // a pipe may only give up a bit at a time
+    while ( got < frames && (n = sf_readf_float(s->snd, &buf[(size_t) got * s->channels], frames - got)) > 0 )
+        got += n;
+    return got;
+}
+
+int soundin_seek(soundin *s, int64_t frame) {
+    if ( s->map ) {
+        if ( frame < 0 || frame > s->frames )
+            return -1;
+        s->pos = frame;
+        return 0;
+    }
+
+    return sf_seek(s->snd, frame, SEEK_SET) < 0 ? -1 : 0;
+}
+
+void soundin_close(soundin *s) {
+    if ( s == NULL )
+        return;
+
+    if ( s->map )
+        munmap(s->map, s->maplen);
+    else
+        sf_close(s->snd);
+    free(s);
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+#ifndef __SOUNDIN_H__
+#define __SOUNDIN_H__
+
+#include <stdint.h>
+
+// sound file input, opened once per file and read front to back. wav and
+// rf64 files of pcm or float samples and raw float files are mapped and converted
+// straight from the mapping; everything else, and stdin, goes through
+// libsndfile. CONVOLUTE_IO=sndfile in the environment turns the mapping off.
+typedef struct soundin soundin;
+
+// path may be "-" for stdin. these return NULL if it can't be opened or
+// isn't a sound file.
+soundin * soundin_open(const char *path);
+
+// headerless little endian floats, which carry no sample rate
+soundin * soundin_open_raw(const char *path, int channels);
+
+// the length in frames is -1 for stdin
+int64_t soundin_frames(const soundin *s);
+int soundin_channels(const soundin *s);
+int soundin_samplerate(const soundin *s); // 0 for raw input
+int soundin_samplebytes(const soundin *s); // per sample as stored, for --stats
+const char * soundin_backend(const soundin *s); // "mmap" or "sndfile"
+
+// reads up to frames interleaved frames. returns fewer only at the end of the input.
+int soundin_read(soundin *s, float *buf, int frames);
+
+// returns 0, or -1 if the input can't seek
+int soundin_seek(soundin *s, int64_t frame);
+
+void soundin_close(soundin *s);
+
+#endif
@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fft.h"
+#include "spectrafile.h"
+
+#define SPECTRA_MAGIC "CNVSPECT"
+#define SPECTRA_VERSION 1
+#define SPECTRA_VERSION_16BIT 2 // the same but for precision, which version 1 readers would ignore
+#define SPECTRA_BYTEORDER 0x01020304
+
+// the header and every stage's spectra start on a boundary this large
+#define SPECTRA_ALIGN 4096
+
+typedef struct {
+    uint32_t blocksize;
+    uint32_t offset;
+    uint32_t parts;
+    uint32_t chunkparts;
+    uint32_t chunks;
+    uint32_t binstride;
+    uint64_t at;        // byte offset of the spectra in the file
+} specstage;
+
+typedef struct {
+    char magic[8];
+    uint32_t byteorder; // reads back differently on a machine of the other endianness
+    uint32_t version;
+    uint32_t samplerate;
+    uint32_t channels;
+    uint64_t length;    // frames in the impulse response
+    uint32_t latency;
+    uint32_t nstages;
+    char backend[16];
+    uint64_t hash;
+    uint64_t size;      // of the whole file
+    specstage stages[PC_MAXSTAGES];
+
+    // one of the PC_ formats. a version 1 file was written before this and
+    // is float32, its header was followed by zeros up to the first stage.
+    // at 16 bits a stage's halves are followed by its scales.
+    uint32_t precision;
+    uint32_t reserved;
+} specheader;
+
+static uint64_t alignup(uint64_t n) {
+    return (n + SPECTRA_ALIGN - 1) / SPECTRA_ALIGN * SPECTRA_ALIGN;
+}
+
+int spectrafile_is(const char *path) {
+    char magic[8];
+    int fd, is = 0;
+
+    if ( (fd = open(path, O_RDONLY)) < 0 )
+        return 0;
+    if ( read(fd, magic, sizeof(magic)) == sizeof(magic) )
+        is = memcmp(magic, SPECTRA_MAGIC, sizeof(magic)) == 0;
+    close(fd);
+
+    return is;
+}
+
+// 64 bit fnv-1a over the samples and the format
+uint64_t spectrafile_hash(const float *data, size_t samples, int channels, int samplerate) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    const unsigned char *bytes = (const unsigned char *) data;
+    int32_t format[2] = { channels, samplerate };
+
+    for (size_t i = 0; i < sizeof(float) * samples; i++)
+        h = (h ^ bytes[i]) * 0x100000001b3ULL;
+    for (size_t i = 0; i < sizeof(format); i++)
+        h = (h ^ ((unsigned char *) format)[i]) * 0x100000001b3ULL;
+
+    return h;
+}
+
+int spectrafile_write(const char *path, pcfilter *f, int samplerate, uint64_t hash) {
+    specheader h;
+    FILE *out;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SPECTRA_MAGIC, sizeof(h.magic));
+    h.byteorder = SPECTRA_BYTEORDER;
+    h.version = f->precision == PC_FLOAT32 ? SPECTRA_VERSION : SPECTRA_VERSION_16BIT;
+    h.samplerate = samplerate;
+    h.channels = f->channels;
+    h.length = f->length;
+    h.latency = f->latency;
+    h.nstages = f->nstages;
+    strncpy(h.backend, fft_backend(), sizeof(h.backend)-1);
+    h.hash = hash;
+    h.precision = f->precision;
+
+    uint64_t at = alignup(sizeof(h));
+    for (int i = 0; i < f->nstages; i++) {
+        pcstage *s = &f->stages[i];
+        h.stages[i].blocksize = s->blocksize;
+        h.stages[i].offset = s->offset;
+        h.stages[i].parts = s->parts;
+        h.stages[i].chunkparts = s->chunkparts;
+        h.stages[i].chunks = s->chunks;
+        h.stages[i].binstride = s->binstride;
+        h.stages[i].at = at;
+        at = alignup(at + pcfilter_stagebytes(f, s));
+    }
+    h.size = at;
+
+    if ( (out = fopen(path, "wb")) == NULL )
+        return -1;
+
+    int failed = fwrite(&h, sizeof(h), 1, out) != 1;
+
+    for (int i = 0; i < f->nstages && !failed; i++) {
+        if ( fseek(out, h.stages[i].at, SEEK_SET) )
+            failed = 1;
+        else if ( fwrite(f->precision == PC_FLOAT32 ? (void *) f->stages[i].spectra : (void *) f->stages[i].halves,
+                         pcfilter_stagebytes(f, &f->stages[i]), 1, out) != 1 )
+            failed = 1;
+    }
+
+    // the last stage's padding, so the mapping covers whole pages of file
+    if ( !failed && (fflush(out) || ftruncate(fileno(out), h.size)) )
+        failed = 1;
+
+    if ( fclose(out) )
+        failed = 1;
+
+    return failed ? -1 : 0;
+}
+
+pcfilter * spectrafile_map(const char *path, int *samplerate, uint64_t *hash, const char **why) {
+    struct stat st;
+    specheader *h;
+    pcfilter *f;
+    const char *dummy;
+    int fd;
+
+    if ( why == NULL )
+        why = &dummy;
+
+    if ( (fd = open(path, O_RDONLY)) < 0 ) {
+        *why = "Couldn't open spectra file";
+        return NULL;
+    }
+    if ( fstat(fd, &st) ) {
+        *why = "Couldn't stat spectra file";
+        close(fd);
+        return NULL;
+    }
+    if ( (size_t) st.st_size < sizeof(specheader) ) {
+        *why = "Spectra file is truncated";
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if ( map == MAP_FAILED ) {
+        *why = "Couldn't map spectra file";
+        return NULL;
+    }
+
+    h = map;
+    *why = NULL;
+    if ( memcmp(h->magic, SPECTRA_MAGIC, sizeof(h->magic)) )
+        *why = "Not a spectra file";
+    else if ( h->byteorder != SPECTRA_BYTEORDER )
+        *why = "Spectra file was prepared on a machine of the other byte order";
+    else if ( h->version != SPECTRA_VERSION && h->version != SPECTRA_VERSION_16BIT )
+        *why = "Spectra file is from an incompatible version";
+    else if ( h->version == SPECTRA_VERSION_16BIT && h->precision != PC_FLOAT16 && h->precision != PC_BFLOAT16 )
+        *why = "Spectra file is corrupt";
+    else if ( h->size > (uint64_t) st.st_size )
+        *why = "Spectra file is truncated";
+    else if ( h->nstages < 1 || h->nstages > PC_MAXSTAGES || h->channels < 1 || h->channels > INT_MAX )
+        *why = "Spectra file is corrupt";
+    else if ( h->latency < 1 || h->latency > INT_MAX || h->length > INT_MAX )
+        *why = "Spectra file is corrupt";
+    else if ( (f = calloc(1, sizeof(*f))) == NULL )
+        *why = "Couldn't malloc space for pcfilter";
+
+    if ( *why ) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    f->latency = h->latency;
+    f->length = h->length;
+    f->channels = h->channels;
+    f->nstages = h->nstages;
+    f->precision = h->version == SPECTRA_VERSION ? PC_FLOAT32 : (int) h->precision;
+    f->map = map;
+    f->maplen = st.st_size;
+
+    // where the partitions so far leave off in the impulse response
+    uint64_t end = 0;
+
+    for (int i = 0; i < f->nstages; i++) {
+        specstage *hs = &h->stages[i];
+        pcstage *s = &f->stages[i];
+        uint64_t spectra = (uint64_t) hs->parts * h->channels;
+        uint64_t perspectrum = pcfilter_binbytes(f->precision) * (uint64_t) hs->binstride +
+                               (f->precision == PC_FLOAT32 ? 0 : sizeof(float));
+
+        // the spectra are used in place, so they have to be laid out the way this build would
+        if ( hs->blocksize < 1 || hs->blocksize > INT_MAX/2 || hs->binstride != (uint32_t) fft_binstride(hs->blocksize*2) )
+            *why = "Spectra file has a partition layout this build can't use";
+        else if ( hs->parts < 1 || hs->parts > INT_MAX || hs->chunkparts < 1 ||
+                  hs->chunks != ((uint64_t) hs->parts + hs->chunkparts - 1) / hs->chunkparts )
+            *why = "Spectra file is corrupt";
+        // each stage's blocks land blocksize-latency frames ahead of where
+        // the output is handed out, so the stages have to follow on from one
+        // another from the start of the impulse, as partconv lays them out
+        else if ( hs->blocksize % h->latency || (i == 0 && hs->blocksize != h->latency) )
+            *why = "Spectra file is corrupt";
+        else if ( hs->offset != end || (uint64_t) hs->offset + h->latency < hs->blocksize )
+            *why = "Spectra file is corrupt";
+        else if ( hs->offset + (uint64_t) hs->parts * hs->blocksize > INT_MAX )
+            *why = "Spectra file is corrupt";
+        // against what's left of the file before anything is multiplied out,
+        // so the stage's byte count can't wrap
+        else if ( hs->at % SPECTRA_ALIGN || hs->at > h->size || spectra > (h->size - hs->at) / perspectrum )
+            *why = "Spectra file is corrupt";
+
+        if ( *why ) {
+            pcfilter_free(f);
+            return NULL;
+        }
+        end = hs->offset + (uint64_t) hs->parts * hs->blocksize;
+
+        s->blocksize = hs->blocksize;
+        s->offset = hs->offset;
+        s->parts = hs->parts;
+        s->chunkparts = hs->chunkparts;
+        s->chunks = hs->chunks;
+        s->binstride = hs->binstride;
+        if ( f->precision == PC_FLOAT32 ) {
+            s->spectra = (fftcpx *) ((char *) map + hs->at);
+        } else {
+            s->halves = (uint16_t *) ((char *) map + hs->at);
+            s->scales = (float *) &s->halves[(size_t) s->binstride * 2 * s->parts * f->channels];
+        }
+    }
+
+    // the partitions cover the impulse response, and the last starts inside it
+    pcstage *last = &f->stages[f->nstages-1];
+    if ( end < h->length || end - last->blocksize >= (h->length ? h->length : 1) ) {
+        *why = "Spectra file is corrupt";
+        pcfilter_free(f);
+        return NULL;
+    }
+
+#ifdef SPEW
+    fprintf(stderr, "mapped spectra from %.16s, hash %016llx\n", h->backend, (unsigned long long) h->hash);
+#endif
+
+    if ( samplerate )
+        *samplerate = h->samplerate;
+    if ( hash )
+        *hash = h->hash;
+
+    posix_madvise(map, st.st_size, POSIX_MADV_WILLNEED);
+
+    return f;
+}
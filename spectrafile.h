@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef __SPECTRAFILE_H__
+#define __SPECTRAFILE_H__
+
+#include <stdint.h>
+
+#include "partconv.h"
+
+// a pcfilter saved by convolute prepare: a header giving the sample rate,
+// the partition layout, the fft backend that made it and a hash of the
+// impulse response, then each stage's spectra on a page boundary, at the
+// precision they were prepared at. mapping
+// one skips decoding and transforming the impulse entirely, and every
+// process using it shares the one copy in the page cache.
+
+// whether path starts like a spectra file
+int spectrafile_is(const char *path);
+
+// a hash of an impulse response's samples, to tell which one a file was prepared from
+uint64_t spectrafile_hash(const float *data, size_t samples, int channels, int samplerate);
+
+// returns -1 with errno set if the file couldn't be written
+int spectrafile_write(const char *path, pcfilter *f, int samplerate, uint64_t hash);
+
+// the filter's spectra point straight into the mapping, which pcfilter_free
+// unmaps. returns NULL and points why at a message if the file can't be
+// used. samplerate, hash and why may be NULL.
+pcfilter * spectrafile_map(const char *path, int *samplerate, uint64_t *hash, const char **why);
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include "fft.h"
+#include "kernels.h"
+#include "stats.h"
+
+// distinct transform lengths tracked, a run only ever uses a handful
+#define STATS_MAXFFTS 32
+
+int stats_on = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static statclock started;
+
+static struct {
+    double wall, cpu;
+    uint64_t calls;
+} stages[STAT_STAGES];
+
+static const char *stagenames[STAT_STAGES] = {
+    "open", "ir_read", "ir_resample", "ir_fft", "decode", "forward_fft",
+    "multiply", "inverse_fft", "overlap", "clip", "encode"
+};
+
+static struct {
+    int len;
+    uint64_t count;
+} ffts[STATS_MAXFFTS];
+static int nffts;
+
+static uint64_t bytesread, byteswritten;
+static int passes;
+static int trimframes = -1, trimkept; // -1 when no impulse was trimmed
+
+static double seconds(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void stats_start(void) {
+    stats_on = 1;
+    stats_clock(&started);
+}
+
+void stats_clock(statclock *c) {
+    c->wall = seconds(CLOCK_MONOTONIC);
+    c->cpu = seconds(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void stats_add(statclock *since, int stage) {
+    statclock now;
+    stats_clock(&now);
+
+    pthread_mutex_lock(&lock);
+    stages[stage].wall += now.wall - since->wall;
+    stages[stage].cpu += now.cpu - since->cpu;
+    stages[stage].calls++;
+    pthread_mutex_unlock(&lock);
+}
+
+void stats_addfft(int len, int count) {
+    pthread_mutex_lock(&lock);
+    int i = 0;
+    while ( i < nffts && ffts[i].len != len )
+        i++;
+    if ( i < STATS_MAXFFTS ) {
+        if ( i == nffts ) {
+            ffts[nffts].len = len;
+            ffts[nffts++].count = 0;
+        }
+        ffts[i].count += count;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void stats_addbytes(uint64_t read, uint64_t written) {
+    pthread_mutex_lock(&lock);
+    bytesread += read;
+    byteswritten += written;
+    pthread_mutex_unlock(&lock);
+}
+
+void stats_addpass(void) {
+    pthread_mutex_lock(&lock);
+    passes++;
+    pthread_mutex_unlock(&lock);
+}
+
+void stats_addtrim(int frames, int kept) {
+    pthread_mutex_lock(&lock);
+    trimframes = frames;
+    trimkept = kept;
+    pthread_mutex_unlock(&lock);
+}
+
+void stats_print(FILE *f) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+
+    pthread_mutex_lock(&lock);
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"wall_s\": %.6f,\n", seconds(CLOCK_MONOTONIC) - started.wall);
+    fprintf(f, "  \"cpu_s\": %.6f,\n", ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6);
+    fprintf(f, "  \"fft_backend\": \"%s\",\n", fft_backend());
+    fprintf(f, "  \"kernels\": \"%s\",\n", kernels_name());
+
+    fprintf(f, "  \"stages\": {\n");
+    for (int i = 0; i < STAT_STAGES; i++)
+        fprintf(f, "    \"%s\": {\"wall_s\": %.6f, \"cpu_s\": %.6f, \"calls\": %llu}%s\n", stagenames[i],
+                stages[i].wall, stages[i].cpu, (unsigned long long) stages[i].calls, i < STAT_STAGES-1 ? "," : "");
+    fprintf(f, "  },\n");
+
+    fprintf(f, "  \"ffts\": [");
+    for (int i = 0; i < nffts; i++)
+        fprintf(f, "%s{\"size\": %d, \"count\": %llu}", i ? ", " : "", ffts[i].len, (unsigned long long) ffts[i].count);
+    fprintf(f, "],\n");
+
+    fprintf(f, "  \"bytes_read\": %llu,\n", (unsigned long long) bytesread);
+    fprintf(f, "  \"bytes_written\": %llu,\n", (unsigned long long) byteswritten);
+    fprintf(f, "  \"passes\": %d,\n", passes);
+    if ( trimframes >= 0 )
+        fprintf(f, "  \"ir_trim\": {\"frames\": %d, \"kept\": %d},\n", trimframes, trimkept);
+    fprintf(f, "  \"peak_rss_kb\": %ld\n", ru.ru_maxrss);
+    fprintf(f, "}\n");
+
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+// where the time of a run goes, for convolute --stats. the stages are timed
+// around each call into them in whichever thread makes it, so with several
+// threads a stage's times are summed over all of them.
+enum {
+    STAT_OPEN,     // opening sound files
+    STAT_IRREAD,   // reading or mapping the impulse response
+    STAT_RESAMPLE, // resampling it to the input's rate
+    STAT_IRFFT,    // partitioning and transforming it
+    STAT_DECODE,   // reading and decoding input
+    STAT_FORWARD,  // forward ffts of the input
+    STAT_MULTIPLY, // spectral multiply-accumulates
+    STAT_INVERSE,  // inverse ffts
+    STAT_OVERLAP,  // placing inverse transforms into the output
+    STAT_CLIP,     // scaling, clipping and peak scans
+    STAT_ENCODE,   // encoding and writing output, or adding it to the scratch file
+    STAT_STAGES
+};
+
+typedef struct {
+    double wall, cpu;
+} statclock;
+
+// set by stats_start, and nothing is recorded until it is
+extern int stats_on;
+
+void stats_start(void);
+
+void stats_clock(statclock *c);
+void stats_add(statclock *since, int stage);
+void stats_addfft(int len, int count);
+void stats_addbytes(uint64_t read, uint64_t written);
+void stats_addpass(void);
+void stats_addtrim(int frames, int kept);
+
+static inline void stats_begin(statclock *c) {
+    if ( stats_on )
+        stats_clock(c);
+}
+
+static inline void stats_end(statclock *c, int stage) {
+    if ( stats_on )
+        stats_add(c, stage);
+}
+
+static inline void stats_fft(int len, int count) {
+    if ( stats_on )
+        stats_addfft(len, count);
+}
+
+static inline void stats_bytes(uint64_t read, uint64_t written) {
+    if ( stats_on )
+        stats_addbytes(read, written);
+}
+
+// one pass over an input
+static inline void stats_pass(void) {
+    if ( stats_on )
+        stats_addpass();
+}
+
+// an impulse response trimmed from frames to kept
+static inline void stats_trim(int frames, int kept) {
+    if ( stats_on )
+        stats_addtrim(frames, kept);
+}
+
+// everything recorded since stats_start as a json document, with the total
+// wall and cpu time and the peak resident memory
+void stats_print(FILE *f);
+
+#endif
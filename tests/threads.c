@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fft.h"
+#include "partconv.h"
+#include "pool.h"
+
+// partconv promises the same output to the bit whatever the thread count.
+// every kind of filter is run once with no workers and again with pools of
+// a few sizes, through partconv_process_batch as the engine drives it, and
+// the outputs have to match exactly.
+
+#define IRLEN 100000
+#define INLEN 200000
+#define INCHANNELS 2
+#define BATCH 8
+
+static float * noise(int n, float level) {
+    float *x = malloc(sizeof(float) * n);
+    unsigned s = 1;
+
+    if ( x == NULL ) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < n; i++) {
+        s = s * 1103515245 + 12345;
+        x[i] = ((s >> 8) / 16777216.0f - 0.5f) * level;
+    }
+    return x;
+}
+
+static float * run(pcfilter *f, const float *in, int threads) {
+    pool *workers = threads > 1 ? pool_new(threads) : NULL;
+    partconv *pc = partconv_new(f, INCHANNELS, workers);
+    int latency = f->latency;
+    int blocks = INLEN / latency;
+    float *out = malloc(sizeof(float) * blocks * latency * INCHANNELS);
+
+    if ( pc == NULL || out == NULL || (threads > 1 && workers == NULL) ) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int b = 0; b < blocks; b += BATCH) {
+        int n = blocks - b < BATCH ? blocks - b : BATCH;
+        partconv_process_batch(pc, &in[b * latency * INCHANNELS], &out[b * latency * INCHANNELS], n);
+    }
+
+    partconv_free(pc);
+    if ( workers )
+        pool_free(workers);
+    return out;
+}
+
+static int check(const char *what, pcfilter *f, const float *in) {
+    static const int threads[] = { 2, 3, 4 };
+    size_t bytes = sizeof(float) * (INLEN / f->latency) * f->latency * INCHANNELS;
+    float *want = run(f, in, 1);
+    int bad = 0;
+
+    for (int i = 0; i < (int) (sizeof(threads) / sizeof(int)); i++) {
+        float *got = run(f, in, threads[i]);
+        if ( memcmp(want, got, bytes) ) {
+            fprintf(stderr, "%s: %d threads differ from 1\n", what, threads[i]);
+            bad = 1;
+        }
+        free(got);
+    }
+    free(want);
+
+    printf("%s, %d stages, %d chunks in the first: %s\n", what, f->nstages, f->stages[0].chunks, bad ? "FAIL" : "ok");
+    return bad;
+}
+
+int main(void) {
+    float *ir = noise(IRLEN, 0.01);
+    float *in = noise(INLEN * INCHANNELS, 1);
+    int bad = 0;
+
+    fft_init(FFT_ESTIMATE);
+
+    pcfilter *uniform = pcfilter_new(ir, IRLEN, 1, 8192, PC_FLOAT32);
+    // latency*4 past the largest partition leaves one stage, in chunks
+    pcfilter *chunked = pcfilter_new_lowlatency(ir, IRLEN, 1, 8192, 8192, PC_FLOAT32);
+    pcfilter *staged = pcfilter_new_lowlatency(ir, IRLEN, 1, 256, 8192, PC_FLOAT32);
+    pcfilter *half = pcfilter_new_lowlatency(ir, IRLEN, 1, 8192, 8192, PC_FLOAT16);
+    if ( !uniform || !chunked || !staged || !half ) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    bad |= check("uniform", uniform, in);
+    bad |= check("low latency, one stage", chunked, in);
+    bad |= check("low latency", staged, in);
+    bad |= check("low latency, one stage at float16", half, in);
+
+    pcfilter_free(uniform);
+    pcfilter_free(chunked);
+    pcfilter_free(staged);
+    pcfilter_free(half);
+    free(ir);
+    free(in);
+
+    return bad ? EXIT_FAILURE : 0;
+}
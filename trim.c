@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "trim.h"
+
+// levels are compared over blocks of this many milliseconds
+#define TRIM_BLOCKMS 10
+
+// fewer blocks than this is too short to tell decay from noise
+#define TRIM_MINBLOCKS 10
+
+// the noise floor is the level of this last fraction of the impulse
+#define TRIM_TAIL 0.1
+
+// the decay is fitted from this many dB under the peak down to this many
+// over the noise floor, as in lundeby's method
+#define TRIM_FITTOP 5
+#define TRIM_FITFLOOR 10
+
+// a tail less than this many dB under the peak is more decay, not noise,
+// as is one whose halves differ by more than this many dB
+#define TRIM_MINRANGE 20
+#define TRIM_FLATNESS 1
+
+// a cut impulse ends in a half cosine of this many milliseconds
+#define TRIM_FADEMS 10
+
+#define TRIM_PI 3.14159265358979323846
+
+static double energy(const float *ir, int i, int channels) {
+    double e = 0;
+    for (int c = 0; c < channels; c++)
+        e += (double) ir[(size_t) i*channels + c] * ir[(size_t) i*channels + c];
+    return e;
+}
+
+static double meanenergy(const float *ir, int from, int to, int channels) {
+    double e = 0;
+    for (int i = from; i < to; i++)
+        e += energy(ir, i, channels);
+    return e / (to - from);
+}
+
+static double decibels(double energy) {
+    return 10 * log10(energy + 1e-30);
+}
+
+// the first frame from which the energy still to come, the schroeder
+// integral, is trimdb under the total
+static int edccut(const float *ir, int frames, int channels, float trimdb) {
+    double total = meanenergy(ir, 0, frames, channels) * frames;
+    double left = total, floor = total * pow(10, -trimdb / 10);
+
+    for (int i = 0; i < frames; i++) {
+        if ( left <= floor )
+            return i > 0 ? i : 1;
+        left -= energy(ir, i, channels);
+    }
+
+    return frames;
+}
+
+// fits a line to the block levels of the decay and follows it down to the
+// noise floor. never cuts into anything clearly over the floor.
+static int noisecut(const float *ir, int frames, int channels, int samplerate, float *noisedb) {
+    int block = samplerate * TRIM_BLOCKMS / 1000 > 0 ? samplerate * TRIM_BLOCKMS / 1000 : 1;
+    int nblocks = frames / block;
+    double *level;
+
+    if ( nblocks < TRIM_MINBLOCKS || (level = malloc(sizeof(double) * nblocks)) == NULL )
+        return frames;
+
+    int peak = 0;
+    for (int b = 0; b < nblocks; b++) {
+        level[b] = decibels(meanenergy(ir, b*block, (b+1)*block, channels));
+        if ( level[b] > level[peak] )
+            peak = b;
+    }
+
+    int tail = frames - frames*TRIM_TAIL, middle = (tail + frames) / 2;
+    double noise = decibels(meanenergy(ir, tail, frames, channels));
+    double slope = decibels(meanenergy(ir, tail, middle, channels)) - decibels(meanenergy(ir, middle, frames, channels));
+    *noisedb = noise - level[peak];
+    if ( level[peak] - noise < TRIM_MINRANGE || fabs(slope) > TRIM_FLATNESS ) {
+        free(level);
+        return frames;
+    }
+
+    int first = peak, last = nblocks - 1;
+    while ( first < nblocks - 1 && level[first] > level[peak] - TRIM_FITTOP )
+        first++;
+    while ( last > first && level[last] <= noise + TRIM_FITFLOOR )
+        last--;
+
+    // least squares over the blocks in between, by block index
+    double cut = last + 1;
+    if ( last > first ) {
+        double n = last - first + 1, sx = 0, sy = 0, sxx = 0, sxy = 0;
+        for (int b = first; b <= last; b++) {
+            sx += b;
+            sy += level[b];
+            sxx += (double) b * b;
+            sxy += b * level[b];
+        }
+        double slope = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+        double at = (sy - slope * sx) / n;
+        if ( slope < 0 && (noise - at) / slope + 0.5 > cut )
+            cut = (noise - at) / slope + 0.5;
+    }
+
+    free(level);
+
+    return cut * block < frames ? cut * block : frames;
+}
+
+void trim_find(const float *ir, int frames, int channels, int samplerate, float trimdb, trimresult *t) {
+    t->frames = frames;
+    t->kept = frames;
+    t->fade = 0;
+    t->noisedb = 0;
+
+    if ( trimdb == TRIM_NOISEFLOOR )
+        t->kept = noisecut(ir, frames, channels, samplerate, &t->noisedb);
+    else if ( trimdb > 0 )
+        t->kept = edccut(ir, frames, channels, trimdb);
+
+    if ( t->kept < frames ) {
+        t->fade = samplerate * TRIM_FADEMS / 1000;
+        if ( t->fade > t->kept / 2 )
+            t->fade = t->kept / 2;
+    }
+}
+
+void trim_fade(float *ir, int channels, const trimresult *t) {
+    for (int k = 0; k < t->fade; k++) {
+        float g = 0.5 * (1 + cos(TRIM_PI * (k+1) / (t->fade+1)));
+        for (int c = 0; c < channels; c++)
+            ir[(size_t) (t->kept - t->fade + k) * channels + c] *= g;
+    }
+}
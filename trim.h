@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2009-2010 Jack Christopher Kastorff <encryptio@gmail.com>
+ * 
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+#ifndef __TRIM_H__
+#define __TRIM_H__
+
+// in place of a level, trim where the decay meets the noise floor
+#define TRIM_NOISEFLOOR -1
+
+typedef struct {
+    int frames;     // of the impulse response as it came
+    int kept;       // up to the cut, frames if there is none
+    int fade;       // frames at the end of those kept that fade out
+    float noisedb;  // the noise floor's level under the peak, when it was looked for
+} trimresult;
+
+// finds where an impulse response's energy decay curve falls trimdb under
+// its total, or with TRIM_NOISEFLOOR where its decay meets the level its
+// tail settles on. an impulse with no clear noise floor isn't cut.
+void trim_find(const float *ir, int frames, int channels, int samplerate, float trimdb, trimresult *t);
+
+// fades out the end of the frames kept of an interleaved impulse response
+void trim_fade(float *ir, int channels, const trimresult *t);
+
+#endif